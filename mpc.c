@@ -1,5 +1,18 @@
+#if defined(__unix__) || defined(__APPLE__)
+/* For fileno, which strict C modes leave undeclared */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#endif
+
 #include "mpc.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MPC_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 /*
 ** State Type
 */
@@ -31,19 +44,31 @@ static mpc_state_t mpc_state_new(void) {
 ** String is easy. The whole contents are 
 ** loaded into a buffer and scanned through.
 ** The cursor can jump around at will making 
-** backtracking easy.
+** backtracking easy. A String input made with
+** `mpc_input_new` borrows the caller's buffer
+** instead, and can be reused for many parses.
 **
 ** The second is a File which is also somewhat
 ** easy. The contents are never loaded into 
 ** memory but backtracking can still be achieved
 ** by seeking in the file at different positions.
 **
+** Where the platform allows it regular files
+** are instead memory mapped (Mmap), and then
+** scanned just like a String, without going
+** through stdio for every character. Anything
+** which can't be mapped, such as a terminal or
+** an empty file, falls back to the File mode.
+**
 ** The final mode is Pipe. This is the difficult
 ** one. As we assume pipes cannot be seeked - and 
 ** only support a single character lookahead at 
 ** any point, when the input is marked for a 
 ** potential backtracking we start buffering any 
-** input.
+** input. The buffer is kept in fixed size chunks
+** so growing it never copies what was already
+** read, and it is dropped again as soon as the
+** earliest mark is released.
 **
 ** This means that if we are requested to seek
 ** back we can simply start reading from the
@@ -58,7 +83,8 @@ static mpc_state_t mpc_state_new(void) {
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3
 };
 
 enum {
@@ -69,20 +95,79 @@ enum {
   MPC_INPUT_MEM_NUM = 512
 };
 
+enum {
+  MPC_INPUT_MEM_WORD = 32,
+  MPC_INPUT_MEM_WORDS = MPC_INPUT_MEM_NUM / MPC_INPUT_MEM_WORD
+};
+
+enum {
+  MPC_INPUT_CHUNK = 4096
+};
+
 typedef struct {
   char mem[64];
 } mpc_mem_t;
 
+/*
+** Small allocations come from pages of 64 byte
+** slots, with one bit per slot marking it used.
+** The first page lives in the input itself and
+** more are added whenever all are full. Added
+** pages are kept sorted by address so finding
+** the page owning a pointer is a binary search.
+*/
+
 typedef struct {
+  int used;
+  unsigned long full[MPC_INPUT_MEM_WORDS];
+  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+} mpc_mem_page_t;
+
+/*
+** Packrat parsers remember their result at each
+** position in a hash table which is never allowed
+** to forget one during a parse, as that is what
+** keeps the parse linear. It grows as needed, so
+** memory is bounded by the number of rules times
+** the length of the input. A table grown past the
+** first size is dropped once the parse is over.
+*/
+
+enum {
+  MPC_INPUT_MEMO_SLOTS = 4096
+};
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  int suppress;
+  int success;
+  int kept;
+  mpc_state_t state;
+  char last;
+  mpc_val_t *output;
+  mpc_err_t *error;
+  mpc_err_t *merged;
+} mpc_memo_t;
+
+struct mpc_input_t {
 
   int type;
+  int borrowed;
   char *filename;  
   mpc_state_t state;
   
   char *string;
-  char *buffer;
+  char **chunks;
+  int chunks_num;
+  size_t buffer_len;
   FILE *file;
   
+  char *map;
+  size_t map_length;
+  long map_offset;
+  size_t length;
+  
   int suppress;
   int backtrack;
   int marks_slots;
@@ -92,11 +177,16 @@ typedef struct {
   char *lasts;
   char last;
   
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  int mem_index;
+  int mem_pages_num;
+  mpc_mem_page_t **mem_pages;
+  mpc_mem_page_t mem;
+  
+  int memo_num;
+  int memo_slots;
+  mpc_memo_t *memo;
   
-} mpc_input_t;
+};
 
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
@@ -108,10 +198,15 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
-  i->buffer = NULL;
+  i->length = strlen(string);
+  i->string = malloc(i->length + 1);
+  memcpy(i->string, string, i->length + 1);
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->buffer_len = 0;
   i->file = NULL;
+  i->map = NULL;
+  i->borrowed = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
@@ -121,8 +216,15 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  
   i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->mem_pages_num = 1;
+  i->mem_pages = NULL;
+  i->mem.used = 0;
+  memset(i->mem.full, 0, sizeof(i->mem.full));
   
   return i;
 }
@@ -140,8 +242,13 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->string = malloc(length + 1);
   strncpy(i->string, string, length);
   i->string[length] = '\0';
-  i->buffer = NULL;
+  i->length = strlen(i->string);
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->buffer_len = 0;
   i->file = NULL;
+  i->map = NULL;
+  i->borrowed = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
@@ -151,8 +258,15 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  
   i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->mem_pages_num = 1;
+  i->mem_pages = NULL;
+  i->mem.used = 0;
+  memset(i->mem.full, 0, sizeof(i->mem.full));
   
   return i;
 
@@ -169,8 +283,12 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
-  i->buffer = NULL;
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->buffer_len = 0;
   i->file = pipe;
+  i->map = NULL;
+  i->borrowed = 0;
   
   i->suppress = 0;
   i->backtrack = 1;
@@ -180,13 +298,45 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  
   i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->mem_pages_num = 1;
+  i->mem_pages = NULL;
+  i->mem.used = 0;
+  memset(i->mem.full, 0, sizeof(i->mem.full));
   
   return i;
   
 }
 
+static void mpc_input_map(mpc_input_t *i) {
+#ifdef MPC_USE_MMAP
+  struct stat st;
+  long offset;
+  void *map;
+  
+  /* Only regular files are safe to map, the rest stays buffered */
+  offset = ftell(i->file);
+  if (offset < 0 || fstat(fileno(i->file), &st) != 0) { return; }
+  if (!S_ISREG(st.st_mode) || st.st_size <= offset) { return; }
+  
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(i->file), 0);
+  if (map == MAP_FAILED) { return; }
+  
+  i->type = MPC_INPUT_MMAP;
+  i->map = map;
+  i->map_length = st.st_size;
+  i->map_offset = offset;
+  i->string = i->map + offset;
+  i->length = st.st_size - offset;
+#else
+  (void)i;
+#endif
+}
+
 static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -197,8 +347,14 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
-  i->buffer = NULL;
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->buffer_len = 0;
   i->file = file;
+  i->map = NULL;
+  i->borrowed = 0;
+  
+  mpc_input_map(i);
   
   i->suppress = 0;
   i->backtrack = 1;
@@ -208,48 +364,155 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  
   i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->mem_pages_num = 1;
+  i->mem_pages = NULL;
+  i->mem.used = 0;
+  memset(i->mem.full, 0, sizeof(i->mem.full));
   
   return i;
 }
 
-static void mpc_input_delete(mpc_input_t *i) {
+mpc_input_t *mpc_input_new(void) {
+  
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  
+  i->filename = NULL;
+  i->type = MPC_INPUT_STRING;
+  i->borrowed = 1;
+  i->state = mpc_state_new();
   
-  free(i->filename);
+  i->string = NULL;
+  i->length = 0;
+  i->chunks = NULL;
+  i->chunks_num = 0;
+  i->buffer_len = 0;
+  i->file = NULL;
+  i->map = NULL;
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
-  if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
   
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  
+  i->mem_index = 0;
+  i->mem_pages_num = 1;
+  i->mem_pages = NULL;
+  i->mem.used = 0;
+  memset(i->mem.full, 0, sizeof(i->mem.full));
+  
+  return i;
+}
+
+void mpc_input_delete(mpc_input_t *i) {
+  
+  if (!i->borrowed) { free(i->filename); }
+  
+  if (i->type == MPC_INPUT_STRING && !i->borrowed) { free(i->string); }
+  while (i->chunks_num > 0) { free(i->chunks[--i->chunks_num]); }
+  free(i->chunks);
+  
+#ifdef MPC_USE_MMAP
+  /* Leave the file where a File input would have left it */
+  if (i->type == MPC_INPUT_MMAP) {
+    fseek(i->file, i->map_offset + i->state.pos, SEEK_SET);
+    munmap(i->map, i->map_length);
+  }
+#endif
+  
+  while (i->mem_pages_num > 1) { free(i->mem_pages[--i->mem_pages_num - 1]); }
+  free(i->mem_pages);
+  
+  free(i->memo);
   free(i->marks);
   free(i->lasts);
   free(i);
 }
 
-static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+static mpc_mem_page_t *mpc_mem_page(mpc_input_t *i, int j) {
+  return j == 0 ? &i->mem : i->mem_pages[j-1];
+}
+
+static int mpc_mem_cmp(mpc_mem_page_t *m, void *p) {
+  if ((char*)p <  (char*)(m->mem)) { return -1; }
+  if ((char*)p >= (char*)(m->mem + MPC_INPUT_MEM_NUM)) { return 1; }
+  return 0;
+}
+
+/* Index of the first added page not below p */
+static int mpc_mem_search(mpc_input_t *i, void *p) {
+  int lo = 0, hi = i->mem_pages_num - 1, mid;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (mpc_mem_cmp(i->mem_pages[mid], p) > 0) { lo = mid + 1; } else { hi = mid; }
+  }
+  return lo;
+}
+
+static mpc_mem_page_t *mpc_mem_ptr(mpc_input_t *i, void *p) {
+  int j;
+  if (mpc_mem_cmp(&i->mem, p) == 0) { return &i->mem; }
+  j = mpc_mem_search(i, p);
+  if (j < i->mem_pages_num - 1 && mpc_mem_cmp(i->mem_pages[j], p) == 0) {
+    return i->mem_pages[j];
+  }
+  return NULL;
+}
+
+static int mpc_mem_free_bit(unsigned long w) {
+#if defined(__GNUC__)
+  return __builtin_ctzl(~w);
+#else
+  int j = 0;
+  while (w & 1) { w >>= 1; j++; }
+  return j;
+#endif
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
+  int j, k, b;
+  mpc_mem_page_t *m;
   
   if (n > sizeof(mpc_mem_t)) { return malloc(n); }
   
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
+  /* Start at the last page used and skip any which are full */
+  for (j = 0; j < i->mem_pages_num; j++) {
+    m = mpc_mem_page(i, i->mem_index);
+    if (m->used < MPC_INPUT_MEM_NUM) {
+      for (k = 0; m->full[k] == 0xFFFFFFFFUL; k++);
+      b = mpc_mem_free_bit(m->full[k]);
+      m->full[k] |= 1UL << b;
+      m->used++;
+      return m->mem + k * MPC_INPUT_MEM_WORD + b;
     }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+    i->mem_index = (i->mem_index+1) % i->mem_pages_num;
+  }
   
-  return malloc(n);
+  m = malloc(sizeof(mpc_mem_page_t));
+  memset(m->full, 0, sizeof(m->full));
+  m->full[0] = 1;
+  m->used = 1;
+  
+  j = mpc_mem_search(i, m->mem);
+  i->mem_pages = realloc(i->mem_pages, sizeof(mpc_mem_page_t*) * i->mem_pages_num);
+  memmove(i->mem_pages + j + 1, i->mem_pages + j,
+    sizeof(mpc_mem_page_t*) * (i->mem_pages_num - 1 - j));
+  i->mem_pages[j] = m;
+  i->mem_pages_num++;
+  i->mem_index = j + 1;
+  
+  return m->mem;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -260,9 +523,11 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 
 static void mpc_free(mpc_input_t *i, void *p) {
   size_t j;
-  if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  mpc_mem_page_t *m = mpc_mem_ptr(i, p);
+  if (!m) { free(p); return; }
+  j = ((size_t)(((char*)p) - ((char*)m->mem))) / sizeof(mpc_mem_t);
+  m->full[j / MPC_INPUT_MEM_WORD] &= ~(1UL << (j % MPC_INPUT_MEM_WORD));
+  m->used--;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
@@ -311,10 +576,6 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
   
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-  
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
@@ -332,9 +593,10 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);      
   }
   
+  /* Keep one chunk around for the next mark */
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
+    while (i->chunks_num > 1) { free(i->chunks[--i->chunks_num]); }
+    i->buffer_len = 0;
   }
   
 }
@@ -354,17 +616,30 @@ static void mpc_input_rewind(mpc_input_t *i) {
 }
 
 static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+  return i->state.pos < (long)i->buffer_len + i->marks[0].pos;
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+  size_t j = i->state.pos - i->marks[0].pos;
+  return i->chunks[j / MPC_INPUT_CHUNK][j % MPC_INPUT_CHUNK];
+}
+
+static void mpc_input_buffer_push(mpc_input_t *i, char c) {
+  
+  if (i->buffer_len == (size_t)i->chunks_num * MPC_INPUT_CHUNK) {
+    i->chunks = realloc(i->chunks, sizeof(char*) * (i->chunks_num + 1));
+    i->chunks[i->chunks_num++] = malloc(MPC_INPUT_CHUNK);
+  }
+  
+  i->chunks[i->buffer_len / MPC_INPUT_CHUNK][i->buffer_len % MPC_INPUT_CHUNK] = c;
+  i->buffer_len++;
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_MMAP && i->state.pos == (long)i->length) { return 1; }
   return 0;
 }
 
@@ -374,13 +649,15 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP:
+      return i->state.pos < (long)i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
-      if (!i->buffer) { c = getc(i->file); return c; }
+      if (i->marks_num == 0) { c = getc(i->file); return c; }
       
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         c = mpc_input_buffer_get(i);
         return c;
       } else {
@@ -397,7 +674,9 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP:
+      return i->state.pos < (long)i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -408,14 +687,14 @@ static char mpc_input_peekc(mpc_input_t *i) {
     
     case MPC_INPUT_PIPE:
       
-      if (!i->buffer) {
+      if (i->marks_num == 0) {
         c = getc(i->file);
         if (feof(i->file)) { return '\0'; }
         ungetc(c, i->file);
         return c;
       }
       
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         return mpc_input_buffer_get(i);
       } else {
         c = getc(i->file);
@@ -436,9 +715,9 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
     case MPC_INPUT_PIPE: {
       
-      if (!i->buffer) { ungetc(c, i->file); break; }
+      if (i->marks_num == 0) { ungetc(c, i->file); break; }
       
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         break;
       } else {
         ungetc(c, i->file); 
@@ -452,10 +731,8 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
   if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
+  &&  i->marks_num > 0 && !mpc_input_buffer_in_range(i)) {
+    mpc_input_buffer_push(i, c);
   }
   
   i->last = c;
@@ -494,16 +771,37 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
+/*
+** Character classes are kept as 256-bit sets
+** so that membership is a single bit lookup
+*/
+
+enum {
+  MPC_SET_SIZE = 256 / 8
+};
+
+static int mpc_set_has(const unsigned char *set, char x) {
+  return (set[(unsigned char)x >> 3] >> ((unsigned char)x & 7)) & 1;
+}
+
+static void mpc_set_add(unsigned char *set, char x) {
+  set[(unsigned char)x >> 3] |= (unsigned char)(1 << ((unsigned char)x & 7));
+}
+
+static void mpc_set_add_string(unsigned char *set, const char *s) {
+  while (*s) { mpc_set_add(set, *s); s++; }
+}
+
+static int mpc_input_oneof(mpc_input_t *i, const unsigned char *set, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return mpc_set_has(set, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_noneof(mpc_input_t *i, const unsigned char *set, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return !mpc_set_has(set, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -575,14 +873,12 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
+static const char *mpc_err_char_unescape(char c, char *buffer) {
   
-  char_unescape_buffer[0] = '\'';
-  char_unescape_buffer[1] = ' ';
-  char_unescape_buffer[2] = '\'';
-  char_unescape_buffer[3] = '\0';
+  buffer[0] = '\'';
+  buffer[1] = ' ';
+  buffer[2] = '\'';
+  buffer[3] = '\0';
   
   switch (c) {
     case '\a': return "bell";
@@ -595,8 +891,8 @@ static const char *mpc_err_char_unescape(char c) {
     case '\t': return "tab";
     case ' ' : return "space";
     default:
-      char_unescape_buffer[1] = c;
-      return char_unescape_buffer;
+      buffer[1] = c;
+      return buffer;
   }
   
 }
@@ -607,6 +903,7 @@ char *mpc_err_string(mpc_err_t *x) {
   int pos = 0; 
   int max = 1023;
   char *buffer = calloc(1, 1024);
+  char unescaped[4];
   
   if (x->failure) {
     mpc_err_string_cat(buffer, &pos, &max,
@@ -631,7 +928,7 @@ char *mpc_err_string(mpc_err_t *x) {
   }
   
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
+  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved, unescaped));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
   
   return realloc(buffer, strlen(buffer) + 1);
@@ -850,6 +1147,34 @@ static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
   return mpc_err_or(i, errs, 2);
 }
 
+static mpc_err_t *mpc_err_copy(mpc_input_t *i, mpc_err_t *x) {
+  
+  int j;
+  mpc_err_t *e;
+  
+  if (x == NULL) { return NULL; }
+  
+  e = mpc_malloc(i, sizeof(mpc_err_t));
+  e->state = x->state;
+  e->recieved = x->recieved;
+  e->expected_num = 0;
+  e->expected = NULL;
+  e->failure = NULL;
+  e->filename = mpc_malloc(i, strlen(x->filename)+1);
+  strcpy(e->filename, x->filename);
+  
+  if (x->failure) {
+    e->failure = mpc_malloc(i, strlen(x->failure)+1);
+    strcpy(e->failure, x->failure);
+  }
+  
+  for (j = 0; j < x->expected_num; j++) {
+    mpc_err_add_expected(i, e, x->expected[j]);
+  }
+  
+  return e;
+}
+
 /*
 ** Parser Type
 */
@@ -882,9 +1207,15 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_SPAN      = 25,
+  MPC_TYPE_DFA       = 26,
+  MPC_TYPE_PACKRAT   = 27
 };
 
+typedef struct mpc_dfa_t mpc_dfa_t;
+
 typedef struct { char *m; } mpc_pdata_fail_t;
 typedef struct { mpc_ctor_t lf; void *x; } mpc_pdata_lift_t;
 typedef struct { mpc_parser_t *x; char *m; } mpc_pdata_expect_t;
@@ -893,6 +1224,7 @@ typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
 typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { char *x; unsigned char set[MPC_SET_SIZE]; int n; char **ms; } mpc_pdata_oneof_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
@@ -900,6 +1232,8 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
 typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_dfa_t *x; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_apply_t cx; } mpc_pdata_packrat_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -910,6 +1244,7 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_oneof_t oneof;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_predict_t predict;
@@ -917,6 +1252,8 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_packrat_t packrat;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -976,8 +1313,9 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
-  mpc_free(i, c);
+  mpc_ast_t *a = mpc_ast_new("", "");
+  free(a->contents);
+  a->contents = mpc_export(i, c);
   return a;
 }
 
@@ -1006,6 +1344,206 @@ enum {
   if (x) { MPC_SUCCESS(r->output); } \
   else { MPC_FAILURE(NULL); }
 
+/*
+** A Span is a `many` or `many1` which folds
+** single characters with `mpcf_strfold`. The
+** characters are matched without making any
+** output and the text is only copied out once
+** at the end, straight from the input where it
+** is held in memory.
+*/
+
+static int mpc_span_char(mpc_input_t *i, mpc_parser_t *p) {
+  switch (p->type) {
+    case MPC_TYPE_ANY:     return mpc_input_any(i, NULL);
+    case MPC_TYPE_SINGLE:  return mpc_input_char(i, p->data.single.x, NULL);
+    case MPC_TYPE_RANGE:   return mpc_input_range(i, p->data.range.x, p->data.range.y, NULL);
+    case MPC_TYPE_ONEOF:   return mpc_input_oneof(i, p->data.oneof.set, NULL);
+    case MPC_TYPE_NONEOF:  return mpc_input_noneof(i, p->data.oneof.set, NULL);
+    case MPC_TYPE_SATISFY: return mpc_input_satisfy(i, p->data.satisfy.f, NULL);
+    case MPC_TYPE_EXPECT:  return mpc_span_char(i, p->data.expect.x);
+    default: return 0;
+  }
+}
+
+static int mpc_span_able(mpc_parser_t *p) {
+  if (p->retained) { return 0; }
+  if (p->type == MPC_TYPE_EXPECT) { return mpc_span_able(p->data.expect.x); }
+  if (p->type == MPC_TYPE_ONEOF && p->data.oneof.n > 0) { return 0; }
+  return p->type >= MPC_TYPE_ANY && p->type <= MPC_TYPE_SATISFY;
+}
+
+static int mpc_parse_dfa(mpc_input_t *i, mpc_dfa_t *d, mpc_result_t *r);
+
+/* The error the last, failed, character would have given */
+static mpc_err_t *mpc_span_err(mpc_input_t *i, mpc_parser_t *p) {
+  return p->type == MPC_TYPE_EXPECT ? mpc_err_new(i, p->data.expect.m) : NULL;
+}
+
+static char *mpc_span(mpc_input_t *i, mpc_parser_t *p, int *n) {
+  
+  long start = i->state.pos;
+  size_t slots = 0;
+  char *s = NULL;
+  
+  *n = 0;
+  
+  if (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP) {
+    while (mpc_span_char(i, p)) { (*n)++; }
+    s = mpc_malloc(i, *n + 1);
+    memcpy(s, i->string + start, *n);
+    s[*n] = '\0';
+    return s;
+  }
+  
+  while (mpc_span_char(i, p)) {
+    if ((size_t)*n + 1 >= slots) {
+      slots = slots ? slots * 2 : sizeof(mpc_mem_t);
+      s = s ? mpc_realloc(i, s, slots) : mpc_malloc(i, slots);
+    }
+    s[(*n)++] = i->last;
+  }
+  
+  if (!s) { s = mpc_malloc(i, 1); }
+  s[*n] = '\0';
+  return s;
+}
+
+/*
+** A Packrat parser looks up the result of its
+** child at the current position before running
+** it. The table keeps copies of errors, and the
+** part of the furthest error that was found along
+** the way, so that a lookup behaves just as running
+** the child again would.
+**
+** Outputs are only kept once a slot is asked for
+** a second time. The first run hands its output
+** straight to the caller, so a parse which never
+** backtracks over a rule never calls `cx`. The
+** first lookup which finds no output runs the child
+** again and keeps what `cx` gives for any lookups
+** after it. For ASTs `cx` just takes a reference,
+** so a lookup costs the same however big the tree.
+*/
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
+
+/* The slot holding this entry, or the empty slot where it would go */
+static mpc_memo_t *mpc_memo_find(mpc_memo_t *memo, int slots, mpc_parser_t *p, long pos, int suppress) {
+  unsigned long h = ((unsigned long)(size_t)p >> 4) * 31 + (unsigned long)pos * 2654435761UL + suppress;
+  unsigned long j = h & (slots - 1);
+  while (memo[j].p && !(memo[j].p == p && memo[j].pos == pos && memo[j].suppress == suppress)) {
+    j = (j + 1) & (slots - 1);
+  }
+  return &memo[j];
+}
+
+static mpc_memo_t *mpc_memo_slot(mpc_input_t *i, mpc_parser_t *p, long pos, int suppress) {
+  
+  int j, slots;
+  mpc_memo_t *memo;
+  
+  if (i->memo == NULL) {
+    i->memo_slots = MPC_INPUT_MEMO_SLOTS;
+    i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+  }
+  
+  /* Keep the load under 3/4 so probe runs stay short */
+  if ((i->memo_num + 1) * 4 > i->memo_slots * 3) {
+    slots = i->memo_slots;
+    memo = i->memo;
+    i->memo_slots = slots * 2;
+    i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+    for (j = 0; j < slots; j++) {
+      if (memo[j].p) {
+        *mpc_memo_find(i->memo, i->memo_slots, memo[j].p, memo[j].pos, memo[j].suppress) = memo[j];
+      }
+    }
+    free(memo);
+  }
+  
+  return mpc_memo_find(i->memo, i->memo_slots, p, pos, suppress);
+}
+
+static void mpc_memo_evict(mpc_input_t *i, mpc_memo_t *m) {
+  if (m->p == NULL) { return; }
+  if (m->output) { m->p->data.packrat.dx(m->output); }
+  if (m->error)  { mpc_err_delete(m->error); }
+  if (m->merged) { mpc_err_delete(m->merged); }
+  m->p = NULL;
+  i->memo_num--;
+}
+
+static void mpc_memo_clear(mpc_input_t *i) {
+  int j;
+  for (j = 0; j < i->memo_slots && i->memo_num > 0; j++) {
+    mpc_memo_evict(i, &i->memo[j]);
+  }
+  if (i->memo_slots > MPC_INPUT_MEMO_SLOTS) {
+    free(i->memo);
+    i->memo = NULL;
+    i->memo_slots = 0;
+  }
+}
+
+static int mpc_parse_packrat(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  int x, keep = 0;
+  long pos = i->state.pos;
+  int suppress = i->suppress > 0;
+  mpc_err_t *merged = NULL;
+  mpc_memo_t *m;
+  
+  /* Only random access inputs can jump to a remembered end */
+  if ((i->type != MPC_INPUT_STRING && i->type != MPC_INPUT_MMAP) || i->backtrack < 1) {
+    return mpc_parse_run(i, p->data.packrat.x, r, e);
+  }
+  
+  m = mpc_memo_slot(i, p, pos, suppress);
+  
+  if (m->p) {
+    if (!m->success || m->kept) {
+      if (m->merged) { *e = mpc_err_merge(i, *e, mpc_err_copy(i, m->merged)); }
+      if (!m->success) {
+        r->error = mpc_err_copy(i, m->error);
+        return 0;
+      }
+      i->state = m->state;
+      i->last = m->last;
+      r->output = m->output ? p->data.packrat.cx(m->output) : NULL;
+      return 1;
+    }
+    keep = 1;
+  }
+  
+  x = mpc_parse_run(i, p->data.packrat.x, r, &merged);
+  
+  /* The child may have grown the table, so only find the slot now */
+  m = mpc_memo_slot(i, p, pos, suppress);
+  mpc_memo_evict(i, m);
+  m->p = p;
+  m->pos = pos;
+  m->suppress = suppress;
+  m->success = x;
+  m->kept = keep;
+  m->state = i->state;
+  m->last = i->last;
+  m->output = NULL;
+  m->error = NULL;
+  m->merged = merged ? mpc_err_export(i, mpc_err_copy(i, merged)) : NULL;
+  i->memo_num++;
+  
+  if (x && keep) {
+    m->output = r->output ? p->data.packrat.cx(r->output) : NULL;
+  } else if (!x && r->error) {
+    m->error = mpc_err_export(i, mpc_err_copy(i, r->error));
+  }
+  
+  if (merged) { *e = mpc_err_merge(i, *e, merged); }
+  return x;
+}
+
 static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
   
   int j = 0, k = 0;
@@ -1020,8 +1558,17 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
     case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
     case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.oneof.set, (char**)&r->output));
+    
+    /* A merged class reports the errors of the `or` it replaced */
+    case MPC_TYPE_ONEOF:
+      if (mpc_input_oneof(i, p->data.oneof.set, (char**)&r->output)) {
+        MPC_SUCCESS(r->output);
+      }
+      for (j = 0; j < p->data.oneof.n; j++) {
+        *e = mpc_err_merge(i, *e, mpc_err_new(i, p->data.oneof.ms[j]));
+      }
+      MPC_FAILURE(NULL);
     case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
     case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
     case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
@@ -1034,6 +1581,8 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
     case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
     case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
     case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+    case MPC_TYPE_DFA:       return mpc_parse_dfa(i, p->data.dfa.x, r);
+    case MPC_TYPE_PACKRAT:   return mpc_parse_packrat(i, p, r, e);
     
     /* Application Parsers */
     
@@ -1147,6 +1696,18 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
           if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
       }
     
+    case MPC_TYPE_SPAN:
+      
+      r->output = mpc_span(i, p->data.repeat.x, &j);
+      
+      if (j < p->data.repeat.n) {
+        mpc_free(i, r->output);
+        MPC_FAILURE(mpc_err_many1(i, mpc_span_err(i, p->data.repeat.x)));
+      } else {
+        *e = mpc_err_merge(i, *e, mpc_span_err(i, p->data.repeat.x));
+        MPC_SUCCESS(r->output);
+      }
+    
     case MPC_TYPE_COUNT:
       
       results = p->data.repeat.n > MPC_PARSE_STACK_MIN
@@ -1237,6 +1798,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
   x = mpc_parse_run(i, p, r, &e);
+  if (i->memo_num > 0) { mpc_memo_clear(i); }
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
@@ -1246,6 +1808,21 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
   return x;
 }
 
+int mpc_parse_borrowed(mpc_input_t *i, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  
+  /* The last parse exported or freed all it used, so mem needs no reset */
+  i->filename = (char*)filename;
+  i->string = (char*)string;
+  i->length = length;
+  i->state = mpc_state_new();
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->last = '\0';
+  
+  return mpc_parse_input(i, p, r);
+}
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_string(filename, string);
@@ -1299,6 +1876,8 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
 */
 
 static void mpc_undefine_unretained(mpc_parser_t *p, int force);
+static mpc_dfa_t *mpc_dfa_copy(mpc_dfa_t *d);
+static void mpc_dfa_delete(mpc_dfa_t *d);
 
 static void mpc_undefine_or(mpc_parser_t *p) {
   
@@ -1323,6 +1902,8 @@ static void mpc_undefine_and(mpc_parser_t *p) {
 
 static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
   
+  int i;
+  
   if (p->retained && !force) { return; }
   
   switch (p->type) {
@@ -1331,6 +1912,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     
     case MPC_TYPE_ONEOF: 
     case MPC_TYPE_NONEOF:
+      free(p->data.oneof.x);
+      for (i = 0; i < p->data.oneof.n; i++) { free(p->data.oneof.ms[i]); }
+      free(p->data.oneof.ms);
+      break;
+    
     case MPC_TYPE_STRING:
       free(p->data.string.x); 
       break;
@@ -1338,6 +1924,7 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_PACKRAT:  mpc_undefine_unretained(p->data.packrat.x, 0);  break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1352,11 +1939,13 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_MANY:
     case MPC_TYPE_MANY1:
     case MPC_TYPE_COUNT:
+    case MPC_TYPE_SPAN:
       mpc_undefine_unretained(p->data.repeat.x, 0);
       break;
     
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
+    case MPC_TYPE_DFA: mpc_dfa_delete(p->data.dfa.x); break;
     
     default: break;
   }
@@ -1428,6 +2017,16 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     
     case MPC_TYPE_ONEOF: 
     case MPC_TYPE_NONEOF:
+      p->data.oneof.x = malloc(strlen(a->data.oneof.x)+1);
+      strcpy(p->data.oneof.x, a->data.oneof.x);
+      if (a->data.oneof.n == 0) { break; }
+      p->data.oneof.ms = malloc(a->data.oneof.n * sizeof(char*));
+      for (i = 0; i < a->data.oneof.n; i++) {
+        p->data.oneof.ms[i] = malloc(strlen(a->data.oneof.ms[i])+1);
+        strcpy(p->data.oneof.ms[i], a->data.oneof.ms[i]);
+      }
+      break;
+    
     case MPC_TYPE_STRING:
       p->data.string.x = malloc(strlen(a->data.string.x)+1);
       strcpy(p->data.string.x, a->data.string.x);
@@ -1436,6 +2035,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_PACKRAT:  p->data.packrat.x  = mpc_copy(a->data.packrat.x);  break;
     
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1451,6 +2051,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_MANY:
     case MPC_TYPE_MANY1:
     case MPC_TYPE_COUNT:
+    case MPC_TYPE_SPAN:
       p->data.repeat.x = mpc_copy(a->data.repeat.x);
       break;
     
@@ -1471,6 +2072,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       }
     break;
     
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_dfa_copy(a->data.dfa.x);
+    break;
+    
     default: break;
   }
 
@@ -1666,19 +2271,25 @@ mpc_parser_t *mpc_range(char s, char e) {
   return mpc_expectf(p, "character between '%c' and '%c'", s, e);
 }
 
+static void mpc_oneof_init(mpc_parser_t *p, char type, const char *s) {
+  p->type = type;
+  p->data.oneof.x = malloc(strlen(s) + 1);
+  strcpy(p->data.oneof.x, s);
+  memset(p->data.oneof.set, 0, MPC_SET_SIZE);
+  mpc_set_add_string(p->data.oneof.set, s);
+  p->data.oneof.n = 0;
+  p->data.oneof.ms = NULL;
+}
+
 mpc_parser_t *mpc_oneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  mpc_oneof_init(p, MPC_TYPE_ONEOF, s);
   return mpc_expectf(p, "one of '%s'", s);
 }
 
 mpc_parser_t *mpc_noneof(const char *s) {
   mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
+  mpc_oneof_init(p, MPC_TYPE_NONEOF, s);
   return mpc_expectf(p, "none of '%s'", s);
 
 }
@@ -1726,6 +2337,15 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_packrat(mpc_parser_t *a, mpc_dtor_t da, mpc_apply_t ca) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PACKRAT;
+  p->data.packrat.x = a;
+  p->data.packrat.dx = da;
+  p->data.packrat.cx = ca;
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -1756,6 +2376,10 @@ mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a) {
   p->type = MPC_TYPE_MANY;
   p->data.repeat.x = a;
   p->data.repeat.f = f;
+  if (f == mpcf_strfold && mpc_span_able(a)) {
+    p->type = MPC_TYPE_SPAN;
+    p->data.repeat.n = 0;
+  }
   return p;
 }
 
@@ -1764,6 +2388,10 @@ mpc_parser_t *mpc_many1(mpc_fold_t f, mpc_parser_t *a) {
   p->type = MPC_TYPE_MANY1;
   p->data.repeat.x = a;
   p->data.repeat.f = f;
+  if (f == mpcf_strfold && mpc_span_able(a)) {
+    p->type = MPC_TYPE_SPAN;
+    p->data.repeat.n = 1;
+  }
   return p;
 }
 
@@ -2030,6 +2658,8 @@ static mpc_val_t *mpcf_re_repeat(int n, mpc_val_t **xs) {
   return mpc_count(num, mpcf_strfold, xs[0], free);
 }
 
+static const char *mpc_re_range_escape_char(char c);
+
 static mpc_parser_t *mpc_re_escape_char(char c) {
   switch (c) {
     case 'a': return mpc_char('\a');
@@ -2043,11 +2673,11 @@ static mpc_parser_t *mpc_re_escape_char(char c) {
     case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
     case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
     case 'd': return mpc_digit();
-    case 'D': return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
+    case 'D': return mpc_noneof(mpc_re_range_escape_char('d'));
     case 's': return mpc_whitespace();
-    case 'S': return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
+    case 'S': return mpc_noneof(mpc_re_range_escape_char('s'));
     case 'w': return mpc_alphanum();
-    case 'W': return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
+    case 'W': return mpc_noneof(mpc_re_range_escape_char('w'));
     default: return NULL;
   }
 }
@@ -2093,20 +2723,13 @@ static const char *mpc_re_range_escape_char(char c) {
   }
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+static char *mpc_re_range_chars(const char *s, int comp) {
   
-  mpc_parser_t *out;
   size_t i, j;
   size_t start, end;
   const char *tmp = NULL;
-  const char *s = x;
-  int comp = s[0] == '^' ? 1 : 0;
   char *range = calloc(1,1);
   
-  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
-  if (s[0] == '^' && 
-      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
-  
   for (i = comp; i < strlen(s); i++){
     
     /* Regex Range Escape */
@@ -2148,6 +2771,21 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   
   }
   
+  return range;
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+  
+  mpc_parser_t *out;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range;
+  
+  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
+  if (s[0] == '^' && 
+      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  
+  range = mpc_re_range_chars(s, comp);
   out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
   
   free(x);
@@ -2223,6 +2861,479 @@ mpc_parser_t *mpc_re(const char *re) {
   
 }
 
+/*
+** DFA Regular Expressions
+**
+** `mpc_re_dfa` compiles a regex to a Thompson
+** NFA which is then run as a DFA, built lazily
+** one state at a time as the input needs them.
+** Matching is one pass with no backtracking and
+** gives a single token for the longest match.
+**
+** Unlike `mpc_re` this means `|` and repeats
+** are not PEG style ordered and possessive, so
+** for example /(a|ab)c/ matches "abc", and
+** /"(\\.|[^"])*"/ will match "a\" by treating
+** the backslash as an ordinary character.
+**
+** Anchors and zero width escapes (\b \B \A \Z)
+** can't be done this way, so regexes using them,
+** or which don't compile cleanly, are given to
+** `mpc_re` instead. So is a regex ending in a
+** lone `\`, which `mpc_re` takes to match the
+** empty string.
+**
+** The DFA states are cached in the parser, so
+** such a parser must not be used from several
+** threads at the same time.
+*/
+
+enum {
+  MPC_NFA_SET   = 0,
+  MPC_NFA_SPLIT = 1,
+  MPC_NFA_EMPTY = 2,
+  MPC_NFA_MATCH = 3
+};
+
+enum {
+  MPC_DFA_UNKNOWN = -1,
+  MPC_DFA_DEAD    = -2,
+  MPC_DFA_MAX     = 256
+};
+
+typedef struct {
+  int type;
+  int out;
+  int out1;
+  unsigned char set[32];
+} mpc_nfa_t;
+
+typedef struct {
+  int start;
+  int end;
+} mpc_nfa_frag_t;
+
+typedef struct {
+  int num;
+  int *states;
+  int accept;
+  int next[256];
+} mpc_dstate_t;
+
+struct mpc_dfa_t {
+  char *re;
+  char *expected;
+  int nfa_num;
+  int nfa_slots;
+  mpc_nfa_t *nfa;
+  int start;
+  int dfa_start;
+  int dfa_flushes;
+  int dfa_num;
+  mpc_dstate_t *dfa[MPC_DFA_MAX];
+};
+
+static int mpc_nfa_add(mpc_dfa_t *d, int type, int out, int out1) {
+  mpc_nfa_t *n;
+  if (d->nfa_num == d->nfa_slots) {
+    d->nfa_slots = d->nfa_slots ? d->nfa_slots * 2 : 32;
+    d->nfa = realloc(d->nfa, sizeof(mpc_nfa_t) * d->nfa_slots);
+  }
+  n = d->nfa + d->nfa_num;
+  n->type = type;
+  n->out = out;
+  n->out1 = out1;
+  memset(n->set, 0, sizeof(n->set));
+  return d->nfa_num++;
+}
+
+static mpc_nfa_frag_t mpc_nfa_empty(mpc_dfa_t *d) {
+  mpc_nfa_frag_t f;
+  f.start = f.end = mpc_nfa_add(d, MPC_NFA_EMPTY, -1, -1);
+  return f;
+}
+
+static mpc_nfa_frag_t mpc_nfa_set(mpc_dfa_t *d, const char *s, int comp) {
+  mpc_nfa_frag_t f;
+  int j;
+  f.end = mpc_nfa_add(d, MPC_NFA_EMPTY, -1, -1);
+  f.start = mpc_nfa_add(d, MPC_NFA_SET, f.end, -1);
+  for (; *s; s++) {
+    d->nfa[f.start].set[(unsigned char)*s / 8] |= 1 << ((unsigned char)*s % 8);
+  }
+  if (comp) {
+    for (j = 0; j < 32; j++) { d->nfa[f.start].set[j] ^= 0xFF; }
+  }
+  return f;
+}
+
+static mpc_nfa_frag_t mpc_nfa_char(mpc_dfa_t *d, char c) {
+  char s[2];
+  s[0] = c; s[1] = '\0';
+  return mpc_nfa_set(d, s, 0);
+}
+
+static mpc_nfa_frag_t mpc_nfa_and(mpc_dfa_t *d, mpc_nfa_frag_t a, mpc_nfa_frag_t b) {
+  d->nfa[a.end].out = b.start;
+  a.end = b.end;
+  return a;
+}
+
+static mpc_nfa_frag_t mpc_nfa_or(mpc_dfa_t *d, mpc_nfa_frag_t a, mpc_nfa_frag_t b) {
+  mpc_nfa_frag_t f;
+  f.end = mpc_nfa_add(d, MPC_NFA_EMPTY, -1, -1);
+  f.start = mpc_nfa_add(d, MPC_NFA_SPLIT, a.start, b.start);
+  d->nfa[a.end].out = f.end;
+  d->nfa[b.end].out = f.end;
+  return f;
+}
+
+/* `many` loops back, `maybe` skips ahead, `many1` does both but enters at `a` */
+static mpc_nfa_frag_t mpc_nfa_repeat(mpc_dfa_t *d, mpc_nfa_frag_t a, char op) {
+  mpc_nfa_frag_t f;
+  f.end = mpc_nfa_add(d, MPC_NFA_EMPTY, -1, -1);
+  f.start = mpc_nfa_add(d, MPC_NFA_SPLIT, a.start, f.end);
+  d->nfa[a.end].out = op == '?' ? f.end : f.start;
+  if (op == '+') { f.start = a.start; }
+  return f;
+}
+
+static int mpc_re_dfa_regex(mpc_dfa_t *d, const char **s, mpc_nfa_frag_t *f);
+
+static int mpc_re_dfa_base(mpc_dfa_t *d, const char **s, mpc_nfa_frag_t *f) {
+  
+  const char *r;
+  char *range;
+  int comp;
+  
+  switch (**s) {
+    
+    case '(':
+      (*s)++;
+      if (!mpc_re_dfa_regex(d, s, f) || **s != ')') { return 0; }
+      (*s)++;
+      return 1;
+    
+    case '[':
+      r = ++(*s);
+      while (*r && *r != ']') { r += (r[0] == '\\' && r[1]) ? 2 : 1; }
+      if (*r != ']' || r == *s || (r == *s + 1 && **s == '^')) { return 0; }
+      range = malloc(r - *s + 1);
+      memcpy(range, *s, r - *s);
+      range[r - *s] = '\0';
+      comp = range[0] == '^' ? 1 : 0;
+      *s += strlen(range) + 1;
+      r = mpc_re_range_chars(range, comp);
+      *f = mpc_nfa_set(d, r, comp);
+      free((char*)r);
+      free(range);
+      return 1;
+    
+    case '\\':
+      if ((*s)[1] == '\0' || strchr("bBAZ", (*s)[1])) { return 0; }
+      if (strchr("DSW", (*s)[1])) {
+        *f = mpc_nfa_set(d, mpc_re_range_escape_char((char)tolower((unsigned char)(*s)[1])), 1);
+        *s += 2;
+        return 1;
+      }
+      r = mpc_re_range_escape_char((*s)[1]);
+      *f = r ? mpc_nfa_set(d, r, 0) : mpc_nfa_char(d, (*s)[1]);
+      *s += 2;
+      return 1;
+    
+    case '.':
+      *f = mpc_nfa_set(d, "", 1);
+      (*s)++;
+      return 1;
+    
+    case '^': case '$': case ')': case '|': case '\0':
+      return 0;
+    
+    default:
+      *f = mpc_nfa_char(d, **s);
+      (*s)++;
+      return 1;
+  }
+}
+
+static int mpc_re_dfa_factor(mpc_dfa_t *d, const char **s, mpc_nfa_frag_t *f) {
+  
+  const char *b = *s, *t;
+  char *e;
+  long j, n;
+  int mark = d->nfa_num;
+  mpc_nfa_frag_t g;
+  
+  if (!mpc_re_dfa_base(d, s, f)) { return 0; }
+  
+  if (**s == '*' || **s == '+' || **s == '?') {
+    *f = mpc_nfa_repeat(d, *f, **s);
+    (*s)++;
+  }
+  
+  /*
+  ** A count uses the base as the first repeat and
+  ** builds it again for the rest. For a count of
+  ** zero the base is dropped, as nothing else can
+  ** point into states added after it began.
+  */
+  else if (**s == '{') {
+    if (!isdigit((unsigned char)(*s)[1])) { return 0; }
+    n = strtol(*s + 1, &e, 10);
+    if (*e != '}') { return 0; }
+    if (n == 0) {
+      d->nfa_num = mark;
+      *f = mpc_nfa_empty(d);
+    }
+    for (j = 1; j < n; j++) {
+      t = b;
+      mpc_re_dfa_base(d, &t, &g);
+      *f = mpc_nfa_and(d, *f, g);
+    }
+    *s = e + 1;
+  }
+  
+  return 1;
+}
+
+static int mpc_re_dfa_regex(mpc_dfa_t *d, const char **s, mpc_nfa_frag_t *f) {
+  
+  mpc_nfa_frag_t g;
+  
+  *f = mpc_nfa_empty(d);
+  while (**s && **s != '|' && **s != ')') {
+    if (!mpc_re_dfa_factor(d, s, &g)) { return 0; }
+    *f = mpc_nfa_and(d, *f, g);
+  }
+  
+  if (**s == '|') {
+    (*s)++;
+    if (!mpc_re_dfa_regex(d, s, &g)) { return 0; }
+    *f = mpc_nfa_or(d, *f, g);
+  }
+  
+  return 1;
+}
+
+static void mpc_dfa_flush(mpc_dfa_t *d) {
+  while (d->dfa_num > 0) {
+    d->dfa_num--;
+    free(d->dfa[d->dfa_num]->states);
+    free(d->dfa[d->dfa_num]);
+  }
+  d->dfa_start = MPC_DFA_UNKNOWN;
+  d->dfa_flushes++;
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  mpc_dfa_flush(d);
+  free(d->nfa);
+  free(d->re);
+  free(d->expected);
+  free(d);
+}
+
+static mpc_dfa_t *mpc_dfa_new(const char *re) {
+  
+  const char *s = re;
+  mpc_nfa_frag_t f;
+  mpc_dfa_t *d = malloc(sizeof(mpc_dfa_t));
+  
+  d->re = malloc(strlen(re) + 1);
+  strcpy(d->re, re);
+  d->expected = malloc(strlen(re) + 3);
+  sprintf(d->expected, "/%s/", re);
+  d->nfa_num = 0;
+  d->nfa_slots = 0;
+  d->nfa = NULL;
+  d->dfa_num = 0;
+  d->dfa_start = MPC_DFA_UNKNOWN;
+  d->dfa_flushes = 0;
+  
+  if (!mpc_re_dfa_regex(d, &s, &f) || *s != '\0') {
+    mpc_dfa_delete(d);
+    return NULL;
+  }
+  
+  d->start = f.start;
+  d->nfa[f.end].out = mpc_nfa_add(d, MPC_NFA_MATCH, -1, -1);
+  return d;
+}
+
+static mpc_dfa_t *mpc_dfa_copy(mpc_dfa_t *d) {
+  return mpc_dfa_new(d->re);
+}
+
+/* Adds everything reachable from `n` without input, keeping only states which consume or match */
+static int mpc_dfa_closure(mpc_dfa_t *d, int n, char *seen, int *stack, int *out, int num) {
+  int top = 0;
+  stack[top++] = n;
+  while (top > 0) {
+    n = stack[--top];
+    if (n < 0 || seen[n]) { continue; }
+    seen[n] = 1;
+    switch (d->nfa[n].type) {
+      case MPC_NFA_SET:
+      case MPC_NFA_MATCH: out[num++] = n; break;
+      case MPC_NFA_SPLIT: stack[top++] = d->nfa[n].out1; stack[top++] = d->nfa[n].out; break;
+      case MPC_NFA_EMPTY: stack[top++] = d->nfa[n].out; break;
+    }
+  }
+  return num;
+}
+
+static int mpc_dfa_cmp(const void *a, const void *b) {
+  return *(const int*)a - *(const int*)b;
+}
+
+static int mpc_dfa_state(mpc_dfa_t *d, int *states, int num) {
+  
+  int j;
+  mpc_dstate_t *s;
+  
+  if (num == 0) { return MPC_DFA_DEAD; }
+  
+  qsort(states, num, sizeof(int), mpc_dfa_cmp);
+  for (j = 0; j < d->dfa_num; j++) {
+    if (d->dfa[j]->num == num
+    &&  memcmp(d->dfa[j]->states, states, sizeof(int) * num) == 0) {
+      return j;
+    }
+  }
+  
+  /* The cache is full, so start it again from nothing */
+  if (d->dfa_num == MPC_DFA_MAX) { mpc_dfa_flush(d); }
+  
+  s = malloc(sizeof(mpc_dstate_t));
+  s->num = num;
+  s->states = malloc(sizeof(int) * num);
+  memcpy(s->states, states, sizeof(int) * num);
+  s->accept = 0;
+  for (j = 0; j < num; j++) {
+    if (d->nfa[states[j]].type == MPC_NFA_MATCH) { s->accept = 1; }
+  }
+  for (j = 0; j < 256; j++) { s->next[j] = MPC_DFA_UNKNOWN; }
+  
+  d->dfa[d->dfa_num] = s;
+  return d->dfa_num++;
+}
+
+static int mpc_dfa_step(mpc_dfa_t *d, int from, unsigned char c) {
+  
+  int j, n, num = 0, to;
+  int flushes = d->dfa_flushes;
+  char *seen;
+  int *stack, *out;
+  mpc_dstate_t *s = from == MPC_DFA_UNKNOWN ? NULL : d->dfa[from];
+  
+  if (s && s->next[c] != MPC_DFA_UNKNOWN) { return s->next[c]; }
+  
+  seen = calloc(d->nfa_num, 1);
+  stack = malloc(sizeof(int) * d->nfa_num * 2);
+  out = malloc(sizeof(int) * d->nfa_num);
+  
+  if (!s) {
+    num = mpc_dfa_closure(d, d->start, seen, stack, out, num);
+  } else {
+    for (j = 0; j < s->num; j++) {
+      n = s->states[j];
+      if (d->nfa[n].type == MPC_NFA_SET && d->nfa[n].set[c / 8] & (1 << (c % 8))) {
+        num = mpc_dfa_closure(d, d->nfa[n].out, seen, stack, out, num);
+      }
+    }
+  }
+  
+  to = mpc_dfa_state(d, out, num);
+  
+  /* Only link the states if `from` survived any flush */
+  if (s && d->dfa_flushes == flushes) { s->next[c] = to; }
+  
+  free(seen);
+  free(stack);
+  free(out);
+  
+  return to;
+}
+
+static int mpc_parse_dfa(mpc_input_t *i, mpc_dfa_t *d, mpc_result_t *r) {
+  
+  long n = 0, acc, start = i->state.pos;
+  int s;
+  char c = '\0';
+  char *buf = NULL;
+  size_t slots = 0;
+  mpc_state_t fail;
+  mpc_err_t *x;
+  int own = i->type != MPC_INPUT_STRING && i->type != MPC_INPUT_MMAP;
+  
+  if (d->dfa_start == MPC_DFA_UNKNOWN) {
+    d->dfa_start = mpc_dfa_step(d, MPC_DFA_UNKNOWN, 0);
+  }
+  s = d->dfa_start;
+  acc = d->dfa[s]->accept ? 0 : -1;
+  
+  mpc_input_backtrack_enable(i);
+  mpc_input_mark(i);
+  
+  while (1) {
+    fail = i->state;
+    c = mpc_input_peekc(i);
+    if (mpc_input_terminated(i)) { c = '\0'; break; }
+    s = mpc_dfa_step(d, s, (unsigned char)c);
+    if (s == MPC_DFA_DEAD) { break; }
+    mpc_input_any(i, NULL);
+    if (own) {
+      if ((size_t)n + 1 >= slots) {
+        slots = slots ? slots * 2 : sizeof(mpc_mem_t);
+        buf = buf ? mpc_realloc(i, buf, slots) : mpc_malloc(i, slots);
+      }
+      buf[n] = c;
+    }
+    n++;
+    if (d->dfa[s]->accept) { acc = n; }
+  }
+  
+  /* Give back anything read past the longest match */
+  if (acc == n) {
+    mpc_input_unmark(i);
+  } else {
+    mpc_input_rewind(i);
+    for (n = 0; n < acc; n++) { mpc_input_any(i, NULL); }
+  }
+  mpc_input_backtrack_disable(i);
+  
+  if (acc < 0) {
+    if (buf) { mpc_free(i, buf); }
+    x = mpc_err_new(i, d->expected);
+    if (x) {
+      x->state = fail;
+      x->recieved = c;
+    }
+    r->error = x;
+    return 0;
+  }
+  
+  if (!own) {
+    buf = mpc_malloc(i, acc + 1);
+    memcpy(buf, i->string + start, acc);
+  } else if (!buf) {
+    buf = mpc_malloc(i, 1);
+  }
+  buf[acc] = '\0';
+  r->output = buf;
+  return 1;
+}
+
+mpc_parser_t *mpc_re_dfa(const char *re) {
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_new(re);
+  if (!d) { return mpc_re(re); }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = d;
+  return p;
+}
+
 /*
 ** Common Fold Functions
 */
@@ -2532,7 +3643,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_ONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.oneof.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[%s]", s);
@@ -2541,7 +3652,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   if (p->type == MPC_TYPE_NONEOF) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.oneof.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[^%s]", s);
@@ -2560,6 +3671,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_print_unretained(p->data.packrat.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2567,6 +3679,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_MANY)  { mpc_print_unretained(p->data.repeat.x, 0); printf("*"); }
   if (p->type == MPC_TYPE_MANY1) { mpc_print_unretained(p->data.repeat.x, 0); printf("+"); }
   if (p->type == MPC_TYPE_COUNT) { mpc_print_unretained(p->data.repeat.x, 0); printf("{%i}", p->data.repeat.n); }
+  if (p->type == MPC_TYPE_SPAN)  { mpc_print_unretained(p->data.repeat.x, 0); printf(p->data.repeat.n ? "+" : "*"); }
+  if (p->type == MPC_TYPE_DFA)   { printf("%s", p->data.dfa.x->expected); }
   
   if (p->type == MPC_TYPE_OR) {
     printf("(");
@@ -2670,6 +3784,7 @@ void mpc_ast_delete(mpc_ast_t *a) {
   int i;
   
   if (a == NULL) { return; }
+  if (--a->refs > 0) { return; }
   
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
@@ -2703,10 +3818,44 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
   
   a->children_num = 0;
   a->children = NULL;
+  a->refs = 1;
   return a;
   
 }
 
+static mpc_ast_t *mpc_ast_ref(mpc_ast_t *a) {
+  a->refs++;
+  return a;
+}
+
+/*
+** Gives the caller a node of its own in place of
+** one of its references to `a`. A shared node is
+** copied one level down, with the copy taking new
+** references to the same children.
+*/
+
+static mpc_ast_t *mpc_ast_own(mpc_ast_t *a) {
+  
+  int i;
+  mpc_ast_t *r;
+  
+  if (a->refs == 1) { return a; }
+  
+  r = mpc_ast_new(a->tag, a->contents);
+  r->state = a->state;
+  r->children_num = a->children_num;
+  r->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  
+  for (i = 0; i < a->children_num; i++) {
+    r->children[i] = mpc_ast_ref(a->children[i]);
+  }
+  
+  a->refs--;
+  return r;
+  
+}
+
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
   
   mpc_ast_t *a = mpc_ast_new(tag, "");
@@ -2725,6 +3874,23 @@ mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
   
 }
 
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  
+  int i;
+  mpc_ast_t *r = mpc_ast_new(a->tag, a->contents);
+  
+  r->state = a->state;
+  r->children_num = a->children_num;
+  r->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  
+  for (i = 0; i < a->children_num; i++) {
+    r->children[i] = mpc_ast_copy(a->children[i]);
+  }
+  
+  return r;
+  
+}
+
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
 
   mpc_ast_t *r;
@@ -2754,6 +3920,7 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
+  r = mpc_ast_own(r);
   r->children_num++;
   r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
   r->children[r->children_num-1] = a;
@@ -2762,6 +3929,7 @@ mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  a = mpc_ast_own(a);
   a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
   memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, strlen(t));
@@ -2771,6 +3939,7 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
+  a = mpc_ast_own(a);
   a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
   memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
   memmove(a->tag, t, (strlen(t)-1));
@@ -2778,6 +3947,7 @@ mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+  a = mpc_ast_own(a);
   a->tag = realloc(a->tag, strlen(t) + 1);
   strcpy(a->tag, t);
   return a;
@@ -2785,6 +3955,7 @@ mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
 
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
   if (a == NULL) { return a; }
+  a = mpc_ast_own(a);
   a->state = s;
   return a;
 }
@@ -3008,6 +4179,9 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
     
     if (as[i] == NULL) { continue; }
     
+    /* Children are taken over below, so the node must be ours */
+    if (as[i]->children_num > 0) { as[i] = mpc_ast_own(as[i]); }
+    
     if        (as[i] && as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
@@ -3065,6 +4239,7 @@ mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
 mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
 mpc_parser_t *mpca_many1(mpc_parser_t *a) { return mpc_many1(mpcf_fold_ast, a); }
 mpc_parser_t *mpca_count(int n, mpc_parser_t *a) { return mpc_count(n, mpcf_fold_ast, a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_packrat(mpc_parser_t *a) { return mpc_packrat(a, (mpc_dtor_t)mpc_ast_delete, (mpc_apply_t)mpc_ast_ref); }
 
 mpc_parser_t *mpca_or(int n, ...) {
 
@@ -3212,7 +4387,8 @@ static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
 static mpc_val_t *mpcaf_grammar_regex(mpc_val_t *x, void *s) {
   mpca_grammar_st_t *st = s;
   char *y = mpcf_unescape_regex(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re(y) : mpc_tok(mpc_re(y));
+  mpc_parser_t *p = (st->flags & MPCA_LANG_DFA_REGEX) ? mpc_re_dfa(y) : mpc_re(y);
+  p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? p : mpc_tok(p);
   free(y);
   return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
 }
@@ -3429,6 +4605,7 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if (st->flags & MPCA_LANG_PACKRAT) { stmt->grammar = mpca_packrat(stmt->grammar); }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
@@ -3623,6 +4800,7 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { return 1 + mpc_nodecount_unretained(p->data.packrat.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
@@ -3630,6 +4808,7 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_MANY)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
 
   if (p->type == MPC_TYPE_OR) { 
     total = 0;
@@ -3657,6 +4836,100 @@ void mpc_stats(mpc_parser_t* p) {
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
 }
 
+/* The single character class under an optional `expect`, if any */
+static mpc_parser_t *mpc_optimise_class(mpc_parser_t *p) {
+  if (p->retained) { return NULL; }
+  if (p->type == MPC_TYPE_EXPECT) { p = p->data.expect.x; }
+  if (p->retained) { return NULL; }
+  switch (p->type) {
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF: return p;
+    default: return NULL;
+  }
+}
+
+static int mpc_optimise_classes(mpc_parser_t *p) {
+  int i;
+  for (i = 0; i < p->data.or.n; i++) {
+    if (!mpc_optimise_class(p->data.or.xs[i])) { return 0; }
+  }
+  return 1;
+}
+
+static void mpc_optimise_message(mpc_pdata_oneof_t *d, const char *m) {
+  d->ms = realloc(d->ms, sizeof(char*) * (d->n+1));
+  d->ms[d->n] = malloc(strlen(m) + 1);
+  strcpy(d->ms[d->n], m);
+  d->n++;
+}
+
+/*
+** Turns an `or` of character classes into a
+** single `oneof`. The expected messages of the
+** alternatives are kept so that failure gives
+** the same error as the `or` would have.
+*/
+static void mpc_optimise_oneof(mpc_parser_t *p) {
+  
+  int i, j, n;
+  char x[256];
+  mpc_parser_t *c, *t;
+  mpc_pdata_oneof_t oneof;
+  
+  memset(oneof.set, 0, MPC_SET_SIZE);
+  oneof.n = 0;
+  oneof.ms = NULL;
+  
+  for (i = 0; i < p->data.or.n; i++) {
+    
+    c = p->data.or.xs[i];
+    t = mpc_optimise_class(c);
+    
+    switch (t->type) {
+      case MPC_TYPE_SINGLE: mpc_set_add(oneof.set, t->data.single.x); break;
+      case MPC_TYPE_RANGE:
+        for (j = 0; j < 256; j++) {
+          if ((char)j >= t->data.range.x && (char)j <= t->data.range.y) {
+            mpc_set_add(oneof.set, (char)j);
+          }
+        }
+      break;
+      case MPC_TYPE_ONEOF:
+        for (j = 0; j < MPC_SET_SIZE; j++) { oneof.set[j] |= t->data.oneof.set[j]; }
+      break;
+      case MPC_TYPE_NONEOF:
+        for (j = 0; j < MPC_SET_SIZE; j++) { oneof.set[j] |= (unsigned char)~t->data.oneof.set[j]; }
+      break;
+      default: break;
+    }
+    
+    if (c->type == MPC_TYPE_EXPECT) {
+      mpc_optimise_message(&oneof, c->data.expect.m);
+    } else if (t->type == MPC_TYPE_ONEOF) {
+      for (j = 0; j < t->data.oneof.n; j++) {
+        mpc_optimise_message(&oneof, t->data.oneof.ms[j]);
+      }
+    }
+    
+  }
+  
+  n = 0;
+  for (j = 1; j < 256; j++) {
+    if (mpc_set_has(oneof.set, (char)j)) { x[n++] = (char)j; }
+  }
+  x[n] = '\0';
+  
+  oneof.x = malloc(n + 1);
+  strcpy(oneof.x, x);
+  
+  mpc_undefine_or(p);
+  p->type = MPC_TYPE_ONEOF;
+  p->data.oneof = oneof;
+  
+}
+
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   
   int i, n, m;
@@ -3670,11 +4943,13 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_optimise_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_optimise_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_optimise_unretained(p->data.packrat.x, 0); }
   if (p->type == MPC_TYPE_NOT)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)    { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_MANY1)    { mpc_optimise_unretained(p->data.repeat.x, 0); }
   if (p->type == MPC_TYPE_COUNT)    { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)     { mpc_optimise_unretained(p->data.repeat.x, 0); }
   
   if (p->type == MPC_TYPE_OR) { 
     for(i = 0; i < p->data.or.n; i++) {
@@ -3719,6 +4994,14 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
     
+    /* Merge `or` of character classes */
+    if (p->type == MPC_TYPE_OR
+    &&  p->data.or.n > 1
+    &&  mpc_optimise_classes(p)) {
+      mpc_optimise_oneof(p);
+      continue;
+    }
+    
     /* Remove ast `pass` */
     if (p->type == MPC_TYPE_AND
     &&  p->data.and.n == 2
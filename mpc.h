@@ -70,6 +70,14 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+struct mpc_input_t;
+typedef struct mpc_input_t mpc_input_t;
+
+mpc_input_t *mpc_input_new(void);
+void mpc_input_delete(mpc_input_t *i);
+
+int mpc_parse_borrowed(mpc_input_t *i, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
+
 /*
 ** Function Types
 */
@@ -139,6 +147,7 @@ mpc_parser_t *mpc_or(int n, ...);
 mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
+mpc_parser_t *mpc_packrat(mpc_parser_t *a, mpc_dtor_t da, mpc_apply_t ca);
 
 /*
 ** Common Parsers
@@ -256,9 +265,17 @@ mpc_val_t *mpcf_maths(int n, mpc_val_t** xs);
 */
 
 mpc_parser_t *mpc_re(const char *re);
+mpc_parser_t *mpc_re_dfa(const char *re);
   
 /*
 ** AST
+**
+** Packrat parsers share subtrees between results,
+** so a node is counted and only freed with its last
+** reference. The functions below copy a node which
+** is shared before changing it and return the node
+** to use from then on. Use `mpc_ast_copy` for a tree
+** that can be changed in place.
 */
 
 typedef struct mpc_ast_t {
@@ -267,10 +284,12 @@ typedef struct mpc_ast_t {
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int refs;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t);
@@ -327,6 +346,7 @@ mpc_parser_t *mpca_maybe(mpc_parser_t *a);
 mpc_parser_t *mpca_many(mpc_parser_t *a);
 mpc_parser_t *mpca_many1(mpc_parser_t *a);
 mpc_parser_t *mpca_count(int n, mpc_parser_t *a);
+mpc_parser_t *mpca_packrat(mpc_parser_t *a);
 
 mpc_parser_t *mpca_or(int n, ...);
 mpc_parser_t *mpca_and(int n, ...);
@@ -334,7 +354,9 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_DFA_REGEX            = 4,
+  MPCA_LANG_PACKRAT              = 8
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
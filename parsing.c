@@ -1,6 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #include "mpc.h"
 
@@ -51,6 +56,11 @@ void add_history(char* unused) {}
   LASSERT(lval, lval->cell[0]->count != 0, "Function '%s' passed empty list.", \
     name);
 
+// shared structures can be copied and dropped from several pmap workers at
+// once, so their refcounts go through these
+#define LREF_INC(refs) __atomic_add_fetch(&(refs), 1, __ATOMIC_RELAXED)
+#define LREF_DEC(refs) __atomic_sub_fetch(&(refs), 1, __ATOMIC_ACQ_REL)
+
 struct lval;
 
 typedef struct lval lval;
@@ -64,7 +74,47 @@ struct lenv {
 
 typedef struct lenv lenv;
 
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN };
+struct lpool;
+struct lsched;
+
+// everything one interpreter needs. interpreters share no mutable state,
+// so separate ones can run on separate threads at the same time
+struct linterp {
+  lenv* env;
+  // worker threads for pmap and preduce, started on first use
+  struct lpool* pool;
+  // green threads from spawn, also made on first use
+  struct lsched* sched;
+  // futures still running. they share env with this thread rather than
+  // copying it, so while there are any, pool threads read env under lock
+  // and every write to it takes the lock
+  int futures;
+  pthread_rwlock_t lock;
+
+  // parse with the mpc grammar instead of the direct reader, which is
+  // slower but handy for checking the reader against the grammar
+  int validate;
+  // reused by every validated parse, reading the line in place
+  mpc_input_t* input;
+
+  mpc_parser_t* Number;
+  mpc_parser_t* Symbol;
+  mpc_parser_t* String;
+  mpc_parser_t* Sexpr;
+  mpc_parser_t* Qexpr;
+  mpc_parser_t* Expr;
+  mpc_parser_t* Lispy;
+};
+
+typedef struct linterp linterp;
+
+// the interpreter this thread is evaluating for, set by linterp_eval and
+// by the pool for its workers
+static __thread linterp* linterp_current = NULL;
+
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN,
+  LVAL_DICT, LVAL_MAP, LVAL_STR, LVAL_BUILDER, LVAL_SEQ, LVAL_FUTURE,
+  LVAL_CHAN };
 
 char* ltype_name(int t) {
   switch (t) {
@@ -74,6 +124,13 @@ char* ltype_name(int t) {
     case LVAL_SYM: return "Symbol";
     case LVAL_SEXPR: return "S-Expression";
     case LVAL_QEXPR: return "Q-Expression";
+    case LVAL_DICT: return "Dictionary";
+    case LVAL_MAP: return "Hash Map";
+    case LVAL_STR: return "String";
+    case LVAL_BUILDER: return "String Builder";
+    case LVAL_SEQ: return "Sequence";
+    case LVAL_FUTURE: return "Future";
+    case LVAL_CHAN: return "Channel";
     default: return "Unknown";
   }
 }
@@ -82,6 +139,119 @@ char* ltype_name(int t) {
 // and returns a pointer to an lval
 typedef lval* (*lbuiltin)(lenv*, lval*);
 
+// open addressing hash table with linear probing. keys are Numbers or
+// Symbols, a NULL key marks an empty slot. the hash of every key is kept
+// next to it so growing and probing rarely have to look at the key itself.
+// copies share the table by refcount, the way maps share their trie, and
+// whoever is about to change it takes a copy of its own first if it's shared
+struct ldict {
+  int refs;
+  int count;
+  int slots;
+  unsigned long* hashes;
+  lval** keys;
+  lval** vals;
+};
+
+typedef struct ldict ldict;
+
+// persistent hash array mapped trie. every node covers 5 bits of the key
+// hash and only stores the slots its bitmap says are used. nodes and leaves
+// never change once built and are shared between versions by refcount, so
+// copying a map is O(1) and assoc/dissoc only copy the path they touch
+struct lhleaf {
+  int refs;
+  unsigned long hash;
+  struct lval* key;
+  struct lval* val;
+};
+
+typedef struct lhleaf lhleaf;
+
+typedef struct {
+  lhleaf* leaf;
+  struct lhamt* child;
+} lhentry;
+
+struct lhamt {
+  int refs;
+  // collision nodes hold leaves that share all 64 hash bits
+  int collision;
+  unsigned int bitmap;
+  int count;
+  lhentry* entries;
+};
+
+typedef struct lhamt lhamt;
+
+// strings that fit in LSTR_INLINE bytes are stored in the lval itself,
+// anything longer is a view of len bytes at off into a refcounted buffer
+// so copies, substrings and split pieces never copy the characters
+enum { LSTR_INLINE = 24, LBUF_MIN = 32 };
+
+// bytes before len never change once written. builders append past len
+// into the spare capacity, which is what lets them share the buffer too
+struct lbuf {
+  int refs;
+  int len;
+  int cap;
+  char data[];
+};
+
+typedef struct lbuf lbuf;
+
+// lazy sequences are immutable chains of stages shared by refcount.
+// nothing is produced until a consumer walks the chain with a cursor
+enum { LSEQ_RANGE, LSEQ_ITERATE, LSEQ_MAP, LSEQ_FILTER, LSEQ_TAKE };
+
+struct lseq {
+  int refs;
+  int kind;
+  // range bounds and step, take keeps its count in end
+  long start;
+  long end;
+  long step;
+  struct lval* func;
+  struct lval* init;
+  struct lseq* src;
+};
+
+typedef struct lseq lseq;
+
+// the shared end of a future. the task evaluating expr holds a reference
+// until it has stored the result and dropped left to 0
+struct lpromise {
+  int refs;
+  int left;
+  struct lval* expr;
+  lenv* env;
+  struct lval* result;
+};
+
+typedef struct lpromise lpromise;
+
+struct lgreen;
+
+// green threads parked on a channel or waiting their turn, oldest first
+typedef struct {
+  struct lgreen* head;
+  struct lgreen* tail;
+} lqueue;
+
+// bounded queue of values between green threads. a full channel parks
+// senders and an empty one parks receivers
+struct lchan {
+  int refs;
+  int cap;
+  int count;
+  int head;
+  struct lval** items;
+  lqueue senders;
+  lqueue receivers;
+};
+
+typedef struct lchan lchan;
+
 struct lval {
   int type;
 
@@ -96,10 +266,65 @@ struct lval {
 
   int count;
   lval** cell;
+
+  ldict* dict;
+  // hash maps keep their size in count
+  lhamt* hamt;
+
+  // strings and builders, builders always have a buffer and off 0
+  int len;
+  int off;
+  lbuf* buf;
+  char str_inline[LSTR_INLINE];
+
+  lseq* seq;
+  lpromise* promise;
+  lchan* chan;
 };
 
+// each thread keeps its own list of freed lvals to hand out again, so pmap
+// workers churning through temporaries don't all queue up on malloc. the
+// list is chained through formals
+enum { LVAL_FREE_MAX = 4096 };
+
+static __thread lval* lval_free_list = NULL;
+static __thread int lval_free_count = 0;
+
+lval* lval_alloc(void) {
+  lval* v = lval_free_list;
+
+  if (!v) { return malloc(sizeof(lval)); }
+
+  lval_free_list = v->formals;
+  lval_free_count--;
+
+  return v;
+}
+
+void lval_free(lval* v) {
+  if (lval_free_count >= LVAL_FREE_MAX) {
+    free(v);
+    return;
+  }
+
+  v->formals = lval_free_list;
+  lval_free_list = v;
+  lval_free_count++;
+}
+
+// hands this thread's spare lvals back before it exits
+void lval_free_drain(void) {
+  while (lval_free_list) {
+    lval* v = lval_free_list;
+    lval_free_list = v->formals;
+    free(v);
+  }
+
+  lval_free_count = 0;
+}
+
 lval* lval_num(long x) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_NUM;
   v->num = x;
 
@@ -107,7 +332,7 @@ lval* lval_num(long x) {
 }
 
 lval* lval_err(char* fmt, ...) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_ERR;
 
   va_list va;
@@ -124,18 +349,23 @@ lval* lval_err(char* fmt, ...) {
   return v;
 }
 
-lval* lval_sym(char* s) {
-  lval* v = malloc(sizeof(lval));
+lval* lval_sym_len(char* s, int len) {
+  lval* v = lval_alloc();
   v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
+  v->sym = malloc(len + 1);
 
-  strcpy(v->sym, s);
+  memcpy(v->sym, s, len);
+  v->sym[len] = '\0';
 
   return v;
 }
 
+lval* lval_sym(char* s) {
+  return lval_sym_len(s, strlen(s));
+}
+
 lval* lval_sexpr(void) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_SEXPR;
   v->count = 0;
   v->cell = NULL;
@@ -144,7 +374,7 @@ lval* lval_sexpr(void) {
 }
 
 lval* lval_qexpr(void) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_QEXPR;
   v->count = 0;
   v->cell = NULL;
@@ -153,7 +383,7 @@ lval* lval_qexpr(void) {
 }
 
 lval* lval_fun(lbuiltin func) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_FUN;
   v->builtin = func;
 
@@ -163,8 +393,140 @@ lval* lval_fun(lbuiltin func) {
 lenv* lenv_new();
 void lenv_put(lenv* e, lval* k, lval* v);
 
+enum { LDICT_MIN = 8 };
+
+ldict* ldict_new(int slots) {
+  ldict* d = malloc(sizeof(ldict));
+  d->refs = 1;
+  d->count = 0;
+  d->slots = slots;
+  d->hashes = malloc(sizeof(unsigned long) * slots);
+  d->keys = calloc(slots, sizeof(lval*));
+  d->vals = malloc(sizeof(lval*) * slots);
+
+  return d;
+}
+
+lval* lval_map(lhamt* root, int count) {
+  lval* v = lval_alloc();
+  v->type = LVAL_MAP;
+  v->hamt = root;
+  v->count = count;
+
+  return v;
+}
+
+lbuf* lbuf_new(int cap) {
+  lbuf* b = malloc(sizeof(lbuf) + cap);
+  b->refs = 1;
+  b->len = 0;
+  b->cap = cap;
+
+  return b;
+}
+
+lval* lval_str(char* s, int len) {
+  lval* v = lval_alloc();
+  v->type = LVAL_STR;
+  v->len = len;
+  v->off = 0;
+
+  if (len <= LSTR_INLINE) {
+    v->buf = NULL;
+    memcpy(v->str_inline, s, len);
+  } else {
+    v->buf = lbuf_new(len);
+    v->buf->len = len;
+    memcpy(v->buf->data, s, len);
+  }
+
+  return v;
+}
+
+char* lval_str_ptr(lval* v) {
+  return v->buf ? v->buf->data + v->off : v->str_inline;
+}
+
+// len bytes of s starting at off, sharing the buffer when there is one
+lval* lval_str_view(lval* s, int off, int len) {
+  if (len <= LSTR_INLINE || !s->buf) {
+    return lval_str(lval_str_ptr(s) + off, len);
+  }
+
+  lval* v = lval_alloc();
+  v->type = LVAL_STR;
+  v->len = len;
+  v->off = s->off + off;
+  v->buf = s->buf;
+  LREF_INC(v->buf->refs);
+
+  return v;
+}
+
+lval* lval_builder(void) {
+  lval* v = lval_alloc();
+  v->type = LVAL_BUILDER;
+  v->len = 0;
+  v->off = 0;
+  v->buf = lbuf_new(LBUF_MIN);
+
+  return v;
+}
+
+// takes over the caller's reference to src
+lseq* lseq_new(int kind, lseq* src) {
+  lseq* s = malloc(sizeof(lseq));
+  s->refs = 1;
+  s->kind = kind;
+  s->start = s->end = s->step = 0;
+  s->func = NULL;
+  s->init = NULL;
+  s->src = src;
+
+  return s;
+}
+
+lval* lval_seq(lseq* s) {
+  lval* v = lval_alloc();
+  v->type = LVAL_SEQ;
+  v->seq = s;
+
+  return v;
+}
+
+lval* lval_future(lpromise* p) {
+  lval* v = lval_alloc();
+  v->type = LVAL_FUTURE;
+  v->promise = p;
+
+  return v;
+}
+
+lval* lval_chan(int cap) {
+  lval* v = lval_alloc();
+  v->type = LVAL_CHAN;
+  v->chan = malloc(sizeof(lchan));
+  v->chan->refs = 1;
+  v->chan->cap = cap;
+  v->chan->count = 0;
+  v->chan->head = 0;
+  v->chan->items = malloc(sizeof(lval*) * cap);
+  v->chan->senders.head = v->chan->senders.tail = NULL;
+  v->chan->receivers.head = v->chan->receivers.tail = NULL;
+
+  return v;
+}
+
+lval* lval_dict(void) {
+  lval* v = lval_alloc();
+  v->type = LVAL_DICT;
+  v->dict = ldict_new(LDICT_MIN);
+
+  return v;
+}
+
 lval* lval_lambda(lval* formals, lval* body) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
 
   v->type = LVAL_FUN;
   v->builtin = NULL;
@@ -202,6 +564,63 @@ void lval_fun_print(lenv* e, lval* v) {
   }
 }
 
+void lval_dict_print(lenv* e, lval* v) {
+  ldict* d = v->dict;
+  int first = 1;
+
+  printf("#{");
+  for (int i = 0; i < d->slots; i++) {
+    if (!d->keys[i]) { continue; }
+
+    if (!first) { putchar(' '); }
+    first = 0;
+
+    lval_print(e, d->keys[i]); putchar(' '); lval_print(e, d->vals[i]);
+  }
+  putchar('}');
+}
+
+void lhamt_print(lenv* e, lhamt* n, int* first) {
+  for (int i = 0; i < n->count; i++) {
+    if (n->entries[i].child) {
+      lhamt_print(e, n->entries[i].child, first);
+      continue;
+    }
+
+    if (!*first) { putchar(' '); }
+    *first = 0;
+
+    lval_print(e, n->entries[i].leaf->key); putchar(' ');
+    lval_print(e, n->entries[i].leaf->val);
+  }
+}
+
+void lval_map_print(lenv* e, lval* v) {
+  int first = 1;
+
+  printf("#map{");
+  if (v->hamt) { lhamt_print(e, v->hamt, &first); }
+  putchar('}');
+}
+
+void lval_str_print(lval* v) {
+  char* s = lval_str_ptr(v);
+
+  putchar('"');
+  for (int i = 0; i < v->len; i++) {
+    switch (s[i]) {
+      case '"': fputs("\\\"", stdout); break;
+      case '\\': fputs("\\\\", stdout); break;
+      case '\n': fputs("\\n", stdout); break;
+      case '\t': fputs("\\t", stdout); break;
+      case '\r': fputs("\\r", stdout); break;
+      case '\0': fputs("\\0", stdout); break;
+      default: putchar(s[i]);
+    }
+  }
+  putchar('"');
+}
+
 void lval_print(lenv* e, lval* v) {
   switch (v->type) {
     case LVAL_NUM: printf("%li", v->num); break;
@@ -210,6 +629,18 @@ void lval_print(lenv* e, lval* v) {
     case LVAL_SEXPR: lval_expr_print(e, v, '(', ')'); break;
     case LVAL_QEXPR: lval_expr_print(e, v, '{', '}'); break;
     case LVAL_FUN: lval_fun_print(e, v); break;
+    case LVAL_DICT: lval_dict_print(e, v); break;
+    case LVAL_MAP: lval_map_print(e, v); break;
+    case LVAL_STR: lval_str_print(v); break;
+    case LVAL_BUILDER: printf("<builder> "); lval_str_print(v); break;
+    case LVAL_SEQ: printf("<sequence>"); break;
+    case LVAL_CHAN:
+      printf("<chan %i/%i>", v->chan->count, v->chan->cap);
+      break;
+    case LVAL_FUTURE:
+      printf(__atomic_load_n(&v->promise->left, __ATOMIC_ACQUIRE)
+        ? "<future>" : "<future done>");
+      break;
   }
 }
 
@@ -227,6 +658,81 @@ void lenv_del(lenv* e);
 
 lenv* lenv_copy(lenv* e);
 
+void lval_del(lval* v);
+
+void lhleaf_release(lhleaf* l) {
+  if (LREF_DEC(l->refs) > 0) { return; }
+
+  lval_del(l->key);
+  lval_del(l->val);
+  free(l);
+}
+
+void lhamt_release(lhamt* n) {
+  if (!n || LREF_DEC(n->refs) > 0) { return; }
+
+  for (int i = 0; i < n->count; i++) {
+    if (n->entries[i].child) {
+      lhamt_release(n->entries[i].child);
+    } else {
+      lhleaf_release(n->entries[i].leaf);
+    }
+  }
+
+  free(n->entries);
+  free(n);
+}
+
+void ldict_release(ldict* d) {
+  if (LREF_DEC(d->refs) > 0) { return; }
+
+  for (int i = 0; i < d->slots; i++) {
+    if (d->keys[i]) {
+      lval_del(d->keys[i]);
+      lval_del(d->vals[i]);
+    }
+  }
+
+  free(d->hashes);
+  free(d->keys);
+  free(d->vals);
+  free(d);
+}
+
+void lseq_release(lseq* s) {
+  // walk down the chain iteratively, it can be as long as the pipeline
+  while (s && LREF_DEC(s->refs) == 0) {
+    lseq* src = s->src;
+
+    if (s->func) { lval_del(s->func); }
+    if (s->init) { lval_del(s->init); }
+    free(s);
+
+    s = src;
+  }
+}
+
+void lpromise_release(lpromise* p) {
+  if (LREF_DEC(p->refs) > 0) { return; }
+
+  if (p->expr) { lval_del(p->expr); }
+  if (p->env) { lenv_del(p->env); }
+  if (p->result) { lval_del(p->result); }
+  free(p);
+}
+
+void lchan_release(lchan* c) {
+  // nothing can be parked here any more, whoever was got no reference
+  if (LREF_DEC(c->refs) > 0) { return; }
+
+  for (int i = 0; i < c->count; i++) {
+    lval_del(c->items[(c->head + i) % c->cap]);
+  }
+
+  free(c->items);
+  free(c);
+}
+
 void lval_del(lval* v) {
   switch (v->type) {
     case LVAL_NUM: break;
@@ -248,9 +754,18 @@ void lval_del(lval* v) {
         lval_del(v->body);
       }
       break;
+    case LVAL_DICT: ldict_release(v->dict); break;
+    case LVAL_MAP: lhamt_release(v->hamt); break;
+    case LVAL_STR:
+    case LVAL_BUILDER:
+      if (v->buf && LREF_DEC(v->buf->refs) == 0) { free(v->buf); }
+      break;
+    case LVAL_SEQ: lseq_release(v->seq); break;
+    case LVAL_FUTURE: lpromise_release(v->promise); break;
+    case LVAL_CHAN: lchan_release(v->chan); break;
   }
 
-  free(v);
+  lval_free(v);
 }
 
 lval* lval_add(lval* v, lval* x) {
@@ -262,7 +777,7 @@ lval* lval_add(lval* v, lval* x) {
 }
 
 lval* lval_copy(lval* v) {
-  lval* x = malloc(sizeof(lval));
+  lval* x = lval_alloc();
   x->type = v->type;
 
   switch (v->type) {
@@ -294,6 +809,40 @@ lval* lval_copy(lval* v) {
         x->body = lval_copy(v->body);
       }
       break;
+    case LVAL_DICT:
+      // shared until one of them changes, see ldict_own
+      x->dict = v->dict;
+      LREF_INC(x->dict->refs);
+      break;
+    case LVAL_MAP:
+      // the whole point of the trie, copies just share the root
+      x->hamt = v->hamt;
+      x->count = v->count;
+      if (x->hamt) { LREF_INC(x->hamt->refs); }
+      break;
+    case LVAL_STR:
+    case LVAL_BUILDER:
+      x->len = v->len;
+      x->off = v->off;
+      x->buf = v->buf;
+      if (x->buf) {
+        LREF_INC(x->buf->refs);
+      } else {
+        memcpy(x->str_inline, v->str_inline, v->len);
+      }
+      break;
+    case LVAL_SEQ:
+      x->seq = v->seq;
+      LREF_INC(x->seq->refs);
+      break;
+    case LVAL_FUTURE:
+      x->promise = v->promise;
+      LREF_INC(x->promise->refs);
+      break;
+    case LVAL_CHAN:
+      x->chan = v->chan;
+      LREF_INC(x->chan->refs);
+      break;
   }
 
   return x;
@@ -323,160 +872,653 @@ lval* lval_take(lval* v, int i) {
   return x;
 }
 
-lval* lval_len(lval* a) {
-  int count = 0;
+// keeps only the children in [start, end) of v, deleting the rest and
+// shifting the survivors down with a single memmove and realloc
+lval* lval_slice(lval* v, int start, int end) {
+  for (int i = 0; i < start; i++) { lval_del(v->cell[i]); }
+  for (int i = end; i < v->count; i++) { lval_del(v->cell[i]); }
 
-  if (a->type != LVAL_SEXPR && a->type != LVAL_QEXPR) {
-    // only s and q expr have children
-    count += 1;
-  } else {
-    int c = a->count;
-    for (int i = 0; i < c; i++) {
-      lval* b = lval_len(lval_pop(a, 0));
-      count += b->num;
-      lval_del(b);
-//      printf("%i\n", a->count);
-    }
-  }
+  memmove(&(v->cell[0]), &(v->cell[start]), sizeof(lval*) * (end - start));
 
-  lval_del(a);
+  v->count = end - start;
+  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
 
-  return lval_num(count);
+  return v;
 }
 
-lval* builtin_len(lenv* e, lval* a) {
-  LASSERT_ARGS(a, 1, "len");
-  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "len");
-  LASSERT_ELIST(a, "len");
-
-  lval* len = lval_len(lval_pop(a, 0));
+int lval_is_key(lval* k) {
+  return k->type == LVAL_NUM || k->type == LVAL_SYM || k->type == LVAL_STR;
+}
 
-  lval_del(a);
+unsigned long lval_hash(lval* k) {
+  unsigned long h;
+
+  if (k->type == LVAL_NUM) {
+    // murmur3 finalizer so nearby numbers land in different slots
+    h = (unsigned long)k->num;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53UL;
+    h ^= h >> 33;
+  } else if (k->type == LVAL_STR) {
+    // fnv-1a over the bytes, offset so "a" and a don't collide
+    char* c = lval_str_ptr(k);
+    h = 14695981039346656037UL ^ LVAL_STR;
+    for (int i = 0; i < k->len; i++) {
+      h ^= (unsigned char)c[i];
+      h *= 1099511628211UL;
+    }
+  } else {
+    // fnv-1a over the symbol name
+    h = 14695981039346656037UL;
+    for (char* c = k->sym; *c; c++) {
+      h ^= (unsigned char)*c;
+      h *= 1099511628211UL;
+    }
+  }
 
-  return len;
+  return h;
 }
 
-lval* builtin_op(lenv* e, lval* a, char* op) {
-  for (int i = 0; i < a->count; i++) {
-    if (a->cell[i]->type != LVAL_NUM) {
-      lval_del(a);
-
-      return lval_err("Cannot operate on non-number");
-    }
+int lval_key_eq(lval* x, lval* y) {
+  if (x->type != y->type) { return 0; }
+  if (x->type == LVAL_NUM) { return x->num == y->num; }
+  if (x->type == LVAL_STR) {
+    return x->len == y->len &&
+      memcmp(lval_str_ptr(x), lval_str_ptr(y), x->len) == 0;
   }
 
-  lval* x = lval_pop(a, 0);
+  return strcmp(x->sym, y->sym) == 0;
+}
 
-  if (strcmp(op, "-") == 0 && a->count == 0) {
-    x->num = -(x->num);
+// slot holding k, or the empty slot where it would go
+int ldict_find(ldict* d, lval* k, unsigned long h) {
+  int mask = d->slots - 1;
+  int i = h & mask;
+
+  while (d->keys[i]) {
+    if (d->hashes[i] == h && lval_key_eq(d->keys[i], k)) { return i; }
+    i = (i + 1) & mask;
   }
 
-  while (a->count > 0) {
-    lval* y = lval_pop(a, 0);
+  return i;
+}
 
-    if (strcmp(op, "+") == 0) { x->num += y->num; }
-    if (strcmp(op, "-") == 0) { x->num -= y->num; }
-    if (strcmp(op, "*") == 0) { x->num *= y->num; }
-    if (strcmp(op, "/") == 0) { 
+void ldict_grow(ldict* d) {
+  int old_slots = d->slots;
+  unsigned long* old_hashes = d->hashes;
+  lval** old_keys = d->keys;
+  lval** old_vals = d->vals;
 
-      if (y->num == 0) {
-        lval_del(x);
-        lval_del(y);
-        x = lval_err("Division by zero");
+  d->slots *= 2;
+  d->hashes = malloc(sizeof(unsigned long) * d->slots);
+  d->keys = calloc(d->slots, sizeof(lval*));
+  d->vals = malloc(sizeof(lval*) * d->slots);
 
-        break;
-      }
+  int mask = d->slots - 1;
+  for (int i = 0; i < old_slots; i++) {
+    if (!old_keys[i]) { continue; }
 
-      x->num /= y->num;
-    }
-    if (strcmp(op, "%") == 0) { x->num %= y->num; }
-    if (strcmp(op, "^") == 0) { x->num = pow(x->num, y->num); }
+    int j = old_hashes[i] & mask;
+    while (d->keys[j]) { j = (j + 1) & mask; }
 
-    lval_del(y);
+    d->hashes[j] = old_hashes[i];
+    d->keys[j] = old_keys[i];
+    d->vals[j] = old_vals[i];
   }
 
-  lval_del(a);
-
-  return x;
+  free(old_hashes);
+  free(old_keys);
+  free(old_vals);
 }
 
-lval* builtin_add(lenv* e, lval* a) {
-  return builtin_op(e, a, "+");
+// the value for k, still owned by the dict, or NULL if it isn't there
+lval* ldict_get(ldict* d, lval* k) {
+  int i = ldict_find(d, k, lval_hash(k));
+  return d->keys[i] ? d->vals[i] : NULL;
 }
 
-lval* builtin_sub(lenv* e, lval* a) {
-  return builtin_op(e, a, "-");
+int ldict_shared(ldict* d) {
+  return __atomic_load_n(&d->refs, __ATOMIC_ACQUIRE) > 1;
 }
 
-lval* builtin_mul(lenv* e, lval* a) {
-  return builtin_op(e, a, "*");
-}
+// gives v a table of its own to change, copying the shared one if need be
+ldict* ldict_own(lval* v) {
+  ldict* d = v->dict;
+  if (!ldict_shared(d)) { return d; }
 
-lval* builtin_div(lenv* e, lval* a) {
-  return builtin_op(e, a, "/");
-}
+  // same slot layout so nothing has to be rehashed
+  ldict* x = ldict_new(d->slots);
+  x->count = d->count;
+  memcpy(x->hashes, d->hashes, sizeof(unsigned long) * d->slots);
 
-lval* builtin_mod(lenv* e, lval* a) {
-  return builtin_op(e, a, "%");
-}
+  for (int i = 0; i < d->slots; i++) {
+    if (d->keys[i]) {
+      x->keys[i] = lval_copy(d->keys[i]);
+      x->vals[i] = lval_copy(d->vals[i]);
+    }
+  }
 
-lval* builtin_pow(lenv* e, lval* a) {
-  return builtin_op(e, a, "^");
+  ldict_release(d);
+  v->dict = x;
+
+  return x;
 }
 
-lval* builtin_head(lenv* e, lval* a) {
-  LASSERT_ARGS(a, 1, "head");
-  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "head");
-  LASSERT_ELIST(a, "head");
+// takes ownership of k and v, replacing any existing value for k
+void ldict_put(ldict* d, lval* k, lval* v) {
+  unsigned long h = lval_hash(k);
+  int i = ldict_find(d, k, h);
 
-  lval* v = lval_take(a, 0);
+  if (d->keys[i]) {
+    lval_del(k);
+    lval_del(d->vals[i]);
+    d->vals[i] = v;
+    return;
+  }
 
-  // why do this? its like head of head?
-  while (v->count > 1) { lval_del(lval_pop(v, 1)); }
+  d->hashes[i] = h;
+  d->keys[i] = k;
+  d->vals[i] = v;
+  d->count++;
 
-  return v;
+  // keep the load under 3/4 so probe runs stay short
+  if (d->count * 4 >= d->slots * 3) { ldict_grow(d); }
 }
 
-lval* builtin_tail(lenv* e, lval* a) {
-  LASSERT_ARGS(a, 1, "tail");
-  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "tail");
-  LASSERT_ELIST(a, "tail");
-
-  lval* v = lval_take(a, 0);
-
-  lval_del(lval_pop(v, 0));
+// unlinks k and hands its value to the caller, NULL if it isn't there.
+// uses backward shift deletion so there are never any tombstones
+lval* ldict_remove(ldict* d, lval* k) {
+  int mask = d->slots - 1;
+  int i = ldict_find(d, k, lval_hash(k));
+
+  if (!d->keys[i]) { return NULL; }
+
+  lval* v = d->vals[i];
+  lval_del(d->keys[i]);
+  d->keys[i] = NULL;
+  d->count--;
+
+  // pull later entries of the probe run back into the hole unless the hole
+  // sits before their home slot
+  int j = i;
+  while (1) {
+    j = (j + 1) & mask;
+    if (!d->keys[j]) { break; }
+
+    int home = d->hashes[j] & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      d->hashes[i] = d->hashes[j];
+      d->keys[i] = d->keys[j];
+      d->vals[i] = d->vals[j];
+      d->keys[j] = NULL;
+      i = j;
+    }
+  }
 
   return v;
 }
 
-lval* builtin_list(lenv* e, lval* a) {
-  a->type = LVAL_QEXPR;
+enum { LHAMT_BITS = 5, LHAMT_MAX_SHIFT = 64 };
 
-  return a;
+lhamt* lhamt_new(int count) {
+  lhamt* n = malloc(sizeof(lhamt));
+  n->refs = 1;
+  n->collision = 0;
+  n->bitmap = 0;
+  n->count = count;
+  n->entries = malloc(sizeof(lhentry) * (count ? count : 1));
+
+  return n;
 }
 
-lval* lval_join(lval* x, lval* y) {
-  while (y->count) {
-    x = lval_add(x, lval_pop(y, 0));
+// a copy of n with room for count entries, sharing every child and leaf.
+// skip leaves out the entry at that index (-1 to keep all of them)
+lhamt* lhamt_clone(lhamt* n, int count, int skip) {
+  lhamt* c = lhamt_new(count);
+  c->collision = n->collision;
+  c->bitmap = n->bitmap;
+
+  int j = 0;
+  for (int i = 0; i < n->count && j < count; i++) {
+    if (i == skip) { continue; }
+
+    c->entries[j] = n->entries[i];
+    if (c->entries[j].child) {
+      LREF_INC(c->entries[j].child->refs);
+    } else {
+      LREF_INC(c->entries[j].leaf->refs);
+    }
+    j++;
+  }
+
+  return c;
+}
+
+void lhentry_release(lhentry* x) {
+  if (x->child) {
+    lhamt_release(x->child);
+  } else {
+    lhleaf_release(x->leaf);
+  }
+}
+
+lhleaf* lhleaf_new(unsigned long h, lval* k, lval* v) {
+  lhleaf* l = malloc(sizeof(lhleaf));
+  l->refs = 1;
+  l->hash = h;
+  l->key = k;
+  l->val = v;
+
+  return l;
+}
+
+int lhamt_index(unsigned int bitmap, unsigned int bit) {
+  return __builtin_popcount(bitmap & (bit - 1));
+}
+
+// builds the smallest subtree holding two leaves whose hashes first differ
+// somewhere at or after shift
+lhamt* lhamt_pair(int shift, lhleaf* a, lhleaf* b) {
+  if (shift >= LHAMT_MAX_SHIFT) {
+    lhamt* n = lhamt_new(2);
+    n->collision = 1;
+    n->entries[0].leaf = a; n->entries[0].child = NULL;
+    n->entries[1].leaf = b; n->entries[1].child = NULL;
+    return n;
+  }
+
+  unsigned int ia = (a->hash >> shift) & 31;
+  unsigned int ib = (b->hash >> shift) & 31;
+
+  if (ia == ib) {
+    lhamt* n = lhamt_new(1);
+    n->bitmap = 1u << ia;
+    n->entries[0].leaf = NULL;
+    n->entries[0].child = lhamt_pair(shift + LHAMT_BITS, a, b);
+    return n;
+  }
+
+  lhamt* n = lhamt_new(2);
+  n->bitmap = (1u << ia) | (1u << ib);
+  n->entries[ia < ib ? 0 : 1].leaf = a;
+  n->entries[ia < ib ? 0 : 1].child = NULL;
+  n->entries[ia < ib ? 1 : 0].leaf = b;
+  n->entries[ia < ib ? 1 : 0].child = NULL;
+
+  return n;
+}
+
+lval* lhamt_get(lhamt* n, unsigned long h, lval* k) {
+  int shift = 0;
+
+  while (n) {
+    if (n->collision) {
+      for (int i = 0; i < n->count; i++) {
+        if (lval_key_eq(n->entries[i].leaf->key, k)) {
+          return n->entries[i].leaf->val;
+        }
+      }
+      return NULL;
+    }
+
+    unsigned int bit = 1u << ((h >> shift) & 31);
+    if (!(n->bitmap & bit)) { return NULL; }
+
+    lhentry* x = &n->entries[lhamt_index(n->bitmap, bit)];
+    if (!x->child) {
+      return x->leaf->hash == h && lval_key_eq(x->leaf->key, k)
+        ? x->leaf->val : NULL;
+    }
+
+    n = x->child;
+    shift += LHAMT_BITS;
+  }
+
+  return NULL;
+}
+
+// returns a new version of n with the leaf added, leaving n untouched.
+// takes ownership of the leaf, added is set when the key wasn't there
+lhamt* lhamt_assoc(lhamt* n, int shift, lhleaf* leaf, int* added) {
+  if (!n) {
+    n = lhamt_new(1);
+    n->bitmap = 1u << ((leaf->hash >> shift) & 31);
+    n->entries[0].leaf = leaf;
+    n->entries[0].child = NULL;
+    *added = 1;
+    return n;
+  }
+
+  if (n->collision) {
+    for (int i = 0; i < n->count; i++) {
+      if (lval_key_eq(n->entries[i].leaf->key, leaf->key)) {
+        lhamt* c = lhamt_clone(n, n->count, -1);
+        lhleaf_release(c->entries[i].leaf);
+        c->entries[i].leaf = leaf;
+        return c;
+      }
+    }
+
+    lhamt* c = lhamt_clone(n, n->count + 1, -1);
+    c->entries[n->count].leaf = leaf;
+    c->entries[n->count].child = NULL;
+    *added = 1;
+    return c;
+  }
+
+  unsigned int bit = 1u << ((leaf->hash >> shift) & 31);
+  int i = lhamt_index(n->bitmap, bit);
+
+  if (!(n->bitmap & bit)) {
+    // open up a slot at i for the new leaf
+    lhamt* c = lhamt_new(n->count + 1);
+    c->bitmap = n->bitmap | bit;
+
+    for (int j = 0; j < n->count; j++) {
+      c->entries[j < i ? j : j + 1] = n->entries[j];
+      if (n->entries[j].child) {
+        LREF_INC(n->entries[j].child->refs);
+      } else {
+        LREF_INC(n->entries[j].leaf->refs);
+      }
+    }
+
+    c->entries[i].leaf = leaf;
+    c->entries[i].child = NULL;
+    *added = 1;
+    return c;
+  }
+
+  lhentry x = n->entries[i];
+  lhamt* c = lhamt_clone(n, n->count, -1);
+  lhentry_release(&c->entries[i]);
+
+  if (x.child) {
+    c->entries[i].child = lhamt_assoc(x.child, shift + LHAMT_BITS, leaf, added);
+    c->entries[i].leaf = NULL;
+  } else if (x.leaf->hash == leaf->hash && lval_key_eq(x.leaf->key, leaf->key)) {
+    c->entries[i].leaf = leaf;
+  } else {
+    // two different keys want the same slot, push both down a level
+    LREF_INC(x.leaf->refs);
+    c->entries[i].child = lhamt_pair(shift + LHAMT_BITS, x.leaf, leaf);
+    c->entries[i].leaf = NULL;
+    *added = 1;
+  }
+
+  return c;
+}
+
+// returns a new version of n without k, or NULL once nothing is left.
+// when k isn't there n itself comes back with an extra reference
+lhamt* lhamt_dissoc(lhamt* n, int shift, unsigned long h, lval* k, int* removed) {
+  if (n->collision) {
+    for (int i = 0; i < n->count; i++) {
+      if (lval_key_eq(n->entries[i].leaf->key, k)) {
+        *removed = 1;
+        return n->count == 1 ? NULL : lhamt_clone(n, n->count - 1, i);
+      }
+    }
+
+    LREF_INC(n->refs);
+    return n;
+  }
+
+  unsigned int bit = 1u << ((h >> shift) & 31);
+  int i = lhamt_index(n->bitmap, bit);
+
+  if (!(n->bitmap & bit)) {
+    LREF_INC(n->refs);
+    return n;
+  }
+
+  lhentry x = n->entries[i];
+  lhamt* sub = NULL;
+
+  if (x.child) {
+    sub = lhamt_dissoc(x.child, shift + LHAMT_BITS, h, k, removed);
+
+    if (!*removed) {
+      lhamt_release(sub);
+      LREF_INC(n->refs);
+      return n;
+    }
+  } else if (x.leaf->hash != h || !lval_key_eq(x.leaf->key, k)) {
+    LREF_INC(n->refs);
+    return n;
+  } else {
+    *removed = 1;
+  }
+
+  if (!sub) {
+    // the slot is gone entirely
+    if (n->count == 1) { return NULL; }
+
+    lhamt* c = lhamt_clone(n, n->count - 1, i);
+    c->bitmap &= ~bit;
+    return c;
+  }
+
+  lhamt* c = lhamt_clone(n, n->count, -1);
+  lhentry_release(&c->entries[i]);
+
+  if (!sub->collision && sub->count == 1 && !sub->entries[0].child) {
+    // a subtree down to one leaf gets pulled back up into this node
+    c->entries[i].leaf = sub->entries[0].leaf;
+    c->entries[i].child = NULL;
+    LREF_INC(c->entries[i].leaf->refs);
+    lhamt_release(sub);
+  } else {
+    c->entries[i].leaf = NULL;
+    c->entries[i].child = sub;
+  }
+
+  return c;
+}
+
+// counts the leaves of a possibly nested list without touching it. uses an
+// explicit stack of (list, next index) pairs instead of recursing
+long lval_deep_count(lval* a) {
+  if (a->type != LVAL_SEXPR && a->type != LVAL_QEXPR) { return 1; }
+
+  long count = 0;
+  int depth = 0;
+  int slots = 16;
+  lval** lists = malloc(sizeof(lval*) * slots);
+  int* next = malloc(sizeof(int) * slots);
+
+  lists[0] = a;
+  next[0] = 0;
+
+  while (depth >= 0) {
+    lval* v = lists[depth];
+
+    if (next[depth] == v->count) {
+      depth--;
+      continue;
+    }
+
+    lval* x = v->cell[next[depth]++];
+
+    if (x->type != LVAL_SEXPR && x->type != LVAL_QEXPR) {
+      count++;
+      continue;
+    }
+
+    depth++;
+    if (depth == slots) {
+      slots *= 2;
+      lists = realloc(lists, sizeof(lval*) * slots);
+      next = realloc(next, sizeof(int) * slots);
+    }
+    lists[depth] = x;
+    next[depth] = 0;
+  }
+
+  free(lists);
+  free(next);
+
+  return count;
+}
+
+lval* builtin_len(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "len");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "len");
+
+  // top level elements only, use deep-count for the nested total
+  lval* len = lval_num(a->cell[0]->count);
+
+  lval_del(a);
+
+  return len;
+}
+
+lval* builtin_deep_count(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "deep-count");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "deep-count");
+
+  lval* count = lval_num(lval_deep_count(a->cell[0]));
+
+  lval_del(a);
+
+  return count;
+}
+
+lval* builtin_op(lenv* e, lval* a, char* op) {
+  for (int i = 0; i < a->count; i++) {
+    if (a->cell[i]->type != LVAL_NUM) {
+      lval_del(a);
+
+      return lval_err("Cannot operate on non-number");
+    }
+  }
+
+  lval* x = lval_pop(a, 0);
+
+  if (strcmp(op, "-") == 0 && a->count == 0) {
+    x->num = -(x->num);
+  }
+
+  while (a->count > 0) {
+    lval* y = lval_pop(a, 0);
+
+    if (strcmp(op, "+") == 0) { x->num += y->num; }
+    if (strcmp(op, "-") == 0) { x->num -= y->num; }
+    if (strcmp(op, "*") == 0) { x->num *= y->num; }
+    if (strcmp(op, "/") == 0) { 
+
+      if (y->num == 0) {
+        lval_del(x);
+        lval_del(y);
+        x = lval_err("Division by zero");
+
+        break;
+      }
+
+      x->num /= y->num;
+    }
+    if (strcmp(op, "%") == 0) { x->num %= y->num; }
+    if (strcmp(op, "^") == 0) { x->num = pow(x->num, y->num); }
+
+    lval_del(y);
   }
 
-  lval_del(y);
+  lval_del(a);
+
+  return x;
+}
+
+lval* builtin_add(lenv* e, lval* a) {
+  return builtin_op(e, a, "+");
+}
+
+lval* builtin_sub(lenv* e, lval* a) {
+  return builtin_op(e, a, "-");
+}
+
+lval* builtin_mul(lenv* e, lval* a) {
+  return builtin_op(e, a, "*");
+}
+
+lval* builtin_div(lenv* e, lval* a) {
+  return builtin_op(e, a, "/");
+}
+
+lval* builtin_mod(lenv* e, lval* a) {
+  return builtin_op(e, a, "%");
+}
+
+lval* builtin_pow(lenv* e, lval* a) {
+  return builtin_op(e, a, "^");
+}
+
+lval* builtin_head(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "head");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "head");
+  LASSERT_ELIST(a, "head");
+
+  lval* v = lval_take(a, 0);
+
+  // head still returns a list, just the one holding the first element
+  return lval_slice(v, 0, 1);
+}
+
+lval* builtin_tail(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "tail");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "tail");
+  LASSERT_ELIST(a, "tail");
+
+  lval* v = lval_take(a, 0);
+
+  lval_del(lval_pop(v, 0));
+
+  return v;
+}
+
+lval* builtin_list(lenv* e, lval* a) {
+  a->type = LVAL_QEXPR;
+
+  return a;
+}
+
+lval* lval_join(lval* x, lval* y) {
+  // move y's children over in one go, y itself is emptied then freed
+  x->cell = realloc(x->cell, sizeof(lval*) * (x->count + y->count));
+  memcpy(&(x->cell[x->count]), y->cell, sizeof(lval*) * y->count);
+  x->count += y->count;
+
+  free(y->cell);
+  free(y);
 
   return x;
 }
 
 lval* builtin_join(lenv* e, lval* a) {
+  LASSERT(a, a->count > 0, "Function 'join' passed no arguments.");
+
   for (int i = 0; i < a->count; i++) {
     LASSERT_TYPE(a, a->cell[i]->type, LVAL_QEXPR, "join");
   }
 
-  lval* x = lval_pop(a, 0);
+  // size the result once up front rather than growing it per list
+  int total = 0;
+  for (int i = 0; i < a->count; i++) { total += a->cell[i]->count; }
+
+  lval* x = a->cell[0];
+  x->cell = realloc(x->cell, sizeof(lval*) * total);
 
-  while (a->count) {
-    x = lval_join(x, lval_pop(a, 0));
+  for (int i = 1; i < a->count; i++) {
+    lval* y = a->cell[i];
+    memcpy(&(x->cell[x->count]), y->cell, sizeof(lval*) * y->count);
+    x->count += y->count;
+    free(y->cell);
+    free(y);
   }
 
-  lval_del(a);
+  free(a->cell);
+  free(a);
 
   return x;
 }
@@ -505,17 +1547,90 @@ lval* builtin_init(lenv* e, lval* a) {
   LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "init");
   LASSERT_ELIST(a, "init");
 
-  lval* b = lval_pop(a, 0);
-  lval* c = lval_qexpr();
+  lval* v = lval_take(a, 0);
+
+  return lval_slice(v, 0, v->count - 1);
+}
+
+// the indexing builtins take the numbers first, like cons, and slice the
+// list they were passed in place so no element ever gets copied
+lval* builtin_nth(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "nth");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_NUM, "nth");
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_QEXPR, "nth");
+
+  long i = a->cell[0]->num;
+  LASSERT(a, i >= 0 && i < a->cell[1]->count,
+    "Function 'nth' index out of range. Got %li, List has %i elements.",
+    i, a->cell[1]->count);
+
+  // unlike head this gives back the element itself
+  return lval_take(lval_take(a, 1), i);
+}
+
+lval* builtin_last(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "last");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "last");
+  LASSERT_ELIST(a, "last");
+
+  lval* v = lval_take(a, 0);
+
+  return lval_take(v, v->count - 1);
+}
 
-  while (b->count > 1) {
-    c = lval_add(c, lval_pop(b, 0));
+lval* builtin_take(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "take");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_NUM, "take");
+  LASSERT(a, a->cell[0]->num >= 0,
+    "Function 'take' passed negative count %li.", a->cell[0]->num);
+
+  if (a->cell[1]->type == LVAL_SEQ) {
+    lseq* s = lseq_new(LSEQ_TAKE, a->cell[1]->seq);
+    LREF_INC(s->src->refs);
+    s->end = a->cell[0]->num;
+    lval_del(a);
+    return lval_seq(s);
   }
 
-  lval_del(a);
-  lval_del(b);
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_QEXPR, "take");
 
-  return c;
+  long n = a->cell[0]->num;
+  lval* v = lval_take(a, 1);
+
+  return lval_slice(v, 0, n < v->count ? n : v->count);
+}
+
+lval* builtin_drop(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "drop");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_NUM, "drop");
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_QEXPR, "drop");
+  LASSERT(a, a->cell[0]->num >= 0,
+    "Function 'drop' passed negative count %li.", a->cell[0]->num);
+
+  long n = a->cell[0]->num;
+  lval* v = lval_take(a, 1);
+
+  return lval_slice(v, n < v->count ? n : v->count, v->count);
+}
+
+lval* builtin_slice(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 3, "slice");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_NUM, "slice");
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_NUM, "slice");
+  LASSERT_TYPE(a, a->cell[2]->type, LVAL_QEXPR, "slice");
+
+  long start = a->cell[0]->num;
+  long end = a->cell[1]->num;
+  LASSERT(a, start >= 0 && start <= end,
+    "Function 'slice' passed invalid range. Got %li to %li.", start, end);
+
+  lval* v = lval_take(a, 2);
+
+  // like take and drop, running off the end just stops at the end
+  if (end > v->count) { end = v->count; }
+  if (start > end) { start = end; }
+
+  return lval_slice(v, start, end);
 }
 
 lval* lval_eval(lenv* e, lval* v);
@@ -551,248 +1666,2537 @@ lval* builtin_lambda(lenv* e, lval* a) {
       ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
   }
 
-  lval* formals = lval_pop(a, 0);
-  lval* body = lval_pop(a, 0);
-  lval_del(a);
+  lval* formals = lval_pop(a, 0);
+  lval* body = lval_pop(a, 0);
+  lval_del(a);
+
+  return lval_lambda(formals, body);
+}
+
+lval* lval_read_num(mpc_ast_t* t) {
+  errno = 0;
+  long x = strtol(t->contents, NULL, 10);
+  return errno != ERANGE ?
+    lval_num(x) : lval_err("invalid number");
+}
+
+// same escapes as mpcf_unescape, anything else keeps its backslash.
+// returns the unescaped length, which may include escaped '\0's
+int str_unescape(char* dst, char* src, int len) {
+  int n = 0;
+
+  for (int i = 0; i < len; i++) {
+    char c = src[i];
+
+    if (c == '\\' && i + 1 < len) {
+      char* esc = strchr("abfnrtv\\'\"0", src[i + 1]);
+      if (esc && src[i + 1]) {
+        dst[n++] = "\a\b\f\n\r\t\v\\'\"\0"[esc - "abfnrtv\\'\"0"];
+        i++;
+        continue;
+      }
+    }
+
+    dst[n++] = c;
+  }
+
+  return n;
+}
+
+lval* lval_read_str(mpc_ast_t* t) {
+  // drop the quotes before undoing the escapes
+  int len = strlen(t->contents) - 2;
+  char* buf = malloc(len + 1);
+  int n = str_unescape(buf, t->contents + 1, len);
+
+  lval* v = lval_str(buf, n);
+  free(buf);
+
+  return v;
+}
+
+lval* lval_read(mpc_ast_t* t) {
+//  printf("Tag: %s\n", t->tag);
+//  printf("Contents: %s\n", t->contents);
+//  printf("Number of children: %d\n", t->children_num);
+
+  if (strstr(t->tag, "number")) { return lval_read_num(t); }
+  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+  if (strstr(t->tag, "string")) { return lval_read_str(t); }
+
+  lval* v = NULL;
+
+  if (strcmp(t->tag, ">") == 0) { 
+    v = lval_sexpr();
+  } else if (strstr(t->tag, "sexpr")) {
+    v = lval_sexpr();
+  } else if (strstr(t->tag, "qexpr")) {
+    v = lval_qexpr(); 
+  } else {
+    v = lval_err("idfk");
+  }
+
+  for (int i = 0; i < t->children_num; i++) {
+    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
+    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
+    if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
+
+    v = lval_add(v, lval_read(t->children[i]));
+  }
+
+  return v;
+}
+
+// single pass reader straight from the input to lvals, no AST in between.
+// it accepts exactly what the grammar in linterp_new does, including how
+// mpc splits 12-3 into two numbers, and reports errors at the same place
+typedef struct {
+  char* filename;
+  char* s;
+  int pos;
+  int row;
+  int col;
+} lreader;
+
+void lreader_next(lreader* r) {
+  if (r->s[r->pos] == '\n') {
+    r->row++;
+    r->col = 0;
+  } else {
+    r->col++;
+  }
+  r->pos++;
+}
+
+void lreader_skip(lreader* r) {
+  while (strchr(" \f\n\r\t\v", r->s[r->pos]) && r->s[r->pos]) {
+    lreader_next(r);
+  }
+}
+
+int lreader_is_sym(char c) {
+  return c && strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "0123456789_+-*/\\=<>!&^%", c);
+}
+
+lval* lreader_err(lreader* r, char* expected) {
+  char c = r->s[r->pos];
+  char quoted[4] = { '\'', c, '\'', '\0' };
+
+  return lval_err("%s:%i:%i: error: expected %s at %s", r->filename,
+    r->row + 1, r->col + 1, expected,
+    c == '\0' ? "end of input" : c == '\n' ? "newline" : quoted);
+}
+
+lval* lreader_str(lreader* r) {
+  lreader start = *r;
+
+  // find the closing quote first so the buffer can be sized once
+  lreader_next(r);
+  while (r->s[r->pos] != '"') {
+    if (r->s[r->pos] == '\\' && r->s[r->pos + 1]) { lreader_next(r); }
+    if (!r->s[r->pos]) { return lreader_err(r, "'\"'"); }
+    lreader_next(r);
+  }
+  lreader_next(r);
+
+  char* buf = malloc(r->pos - start.pos);
+  int n = str_unescape(buf, r->s + start.pos + 1, r->pos - start.pos - 2);
+
+  lval* v = lval_str(buf, n);
+  free(buf);
+
+  return v;
+}
+
+lval* lreader_expr(lreader* r, char* expected);
+
+lval* lreader_list(lreader* r, lval* v, char close, char* expected) {
+  lreader_next(r);
+  lreader_skip(r);
+
+  while (r->s[r->pos] != close) {
+    if (!r->s[r->pos] || r->s[r->pos] == ')' || r->s[r->pos] == '}') {
+      lval_del(v);
+      return lreader_err(r, expected);
+    }
+
+    lval* x = lreader_expr(r, expected);
+    if (x->type == LVAL_ERR) {
+      lval_del(v);
+      return x;
+    }
+
+    v = lval_add(v, x);
+  }
+
+  lreader_next(r);
+  lreader_skip(r);
+
+  return v;
+}
+
+lval* lreader_expr(lreader* r, char* expected) {
+  char* c = &r->s[r->pos];
+  lval* v;
+
+  if (*c == '(') {
+    return lreader_list(r, lval_sexpr(), ')', "expression or ')'");
+  }
+  if (*c == '{') {
+    return lreader_list(r, lval_qexpr(), '}', "expression or '}'");
+  }
+
+  if (*c == '"') {
+    v = lreader_str(r);
+  } else if (isdigit((unsigned char)c[0]) ||
+      (c[0] == '-' && isdigit((unsigned char)c[1]))) {
+    // numbers win over symbols, like number coming first in expr
+    int len = 1;
+    while (isdigit((unsigned char)c[len])) { len++; }
+
+    errno = 0;
+    long x = strtol(c, NULL, 10);
+    v = errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+
+    for (int i = 0; i < len; i++) { lreader_next(r); }
+  } else if (lreader_is_sym(*c)) {
+    int len = 0;
+    while (lreader_is_sym(c[len])) { len++; }
+
+    v = lval_sym_len(c, len);
+
+    for (int i = 0; i < len; i++) { lreader_next(r); }
+  } else {
+    return lreader_err(r, expected);
+  }
+
+  lreader_skip(r);
+
+  return v;
+}
+
+// reads every expression in input into one S-Expression, like the lispy
+// rule does, or gives back the first error
+lval* lval_read_input(char* filename, char* input) {
+  lreader r = { filename, input, 0, 0, 0 };
+  lval* v = lval_sexpr();
+
+  lreader_skip(&r);
+
+  while (r.s[r.pos]) {
+    lval* x = r.s[r.pos] == ')' || r.s[r.pos] == '}'
+      ? lreader_err(&r, "expression or end of input")
+      : lreader_expr(&r, "expression or end of input");
+
+    if (x->type == LVAL_ERR) {
+      lval_del(v);
+      return x;
+    }
+
+    v = lval_add(v, x);
+  }
+
+  return v;
+}
+
+lval* lval_call(lenv* e, lval* func, lval* args) {
+  if (func->builtin) {
+    return func->builtin(e, args);
+  }
+
+  int given = args->count;
+  int total = func->formals->count;
+
+  while (args->count) {
+    if (func->formals->count == 0) {
+      lval_del(args);
+      return lval_err("Function passed too many arguments. "
+      "Got %i. Expected %i.", given, total);
+    }
+
+    lval* sym = lval_pop(func->formals, 0);
+    lval* val = lval_pop(args, 0);
+
+    lenv_put(func->env, sym, val);
+    lval_del(sym);
+    lval_del(val);
+  }
+
+  lval_del(args);
+
+  if (func->formals->count == 0) {
+    func->env->par = e;
+
+    return builtin_eval(func->env,
+      lval_add(lval_sexpr(), lval_copy(func->body)));
+  } else {
+    return lval_copy(func);
+  }
+}
+
+// an argument frame is an S-Expression that only borrows its cells, so the
+// same frame can be refilled and passed to lval_apply over and over
+lval* lval_frame(int count) {
+  lval* v = lval_sexpr();
+  v->count = count;
+  v->cell = malloc(sizeof(lval*) * count);
+
+  return v;
+}
+
+void lval_frame_del(lval* v) {
+  // the cells belong to someone else so only free the array
+  free(v->cell);
+  lval_free(v);
+}
+
+// like lval_call but leaves both func and the frame untouched so that
+// builtins like map can call the same function once per element
+lval* lval_apply(lenv* e, lval* func, lval* frame) {
+  if (func->builtin) {
+    return func->builtin(e, lval_copy(frame));
+  }
+
+  if (frame->count != func->formals->count) {
+    // partial application (or an arity error) goes through the normal path,
+    // which pops formals so it needs its own copy of the function
+    lval* f = lval_copy(func);
+    lval* result = lval_call(e, f, lval_copy(frame));
+    lval_del(f);
+
+    return result;
+  }
+
+  // bind the arguments in a fresh scope in front of the function env
+  // instead of copying the whole function for every call
+  lenv* scope = lenv_new();
+  scope->par = func->env;
+  func->env->par = e;
+
+  for (int i = 0; i < frame->count; i++) {
+    lenv_put(scope, func->formals->cell[i], frame->cell[i]);
+  }
+
+  lval* result = builtin_eval(scope,
+    lval_add(lval_sexpr(), lval_copy(func->body)));
+  lenv_del(scope);
+
+  return result;
+}
+
+// a cursor walks one sequence once, with one cursor per stage of the chain
+struct lseq_it {
+  lseq* seq;
+  long i;
+  // lval_apply rewires the function's env so every cursor needs its own
+  lval* func;
+  lval* cur;
+  lval* frame;
+  struct lseq_it* src;
+};
+
+typedef struct lseq_it lseq_it;
+
+lseq_it* lseq_it_new(lseq* s) {
+  lseq_it* it = malloc(sizeof(lseq_it));
+  it->seq = s;
+  it->i = s->start;
+  it->func = s->func ? lval_copy(s->func) : NULL;
+  it->cur = NULL;
+  it->frame = lval_frame(1);
+  it->src = s->src ? lseq_it_new(s->src) : NULL;
+
+  return it;
+}
+
+void lseq_it_del(lseq_it* it) {
+  while (it) {
+    lseq_it* src = it->src;
+
+    if (it->func) { lval_del(it->func); }
+    if (it->cur) { lval_del(it->cur); }
+    lval_frame_del(it->frame);
+    free(it);
+
+    it = src;
+  }
+}
+
+// the next element, or NULL once the sequence is done. errors come back
+// as the element and the caller is expected to stop there
+lval* lseq_next(lenv* e, lseq_it* it) {
+  lseq* s = it->seq;
+  lval* x;
+
+  switch (s->kind) {
+    case LSEQ_RANGE:
+      if (s->step > 0 ? it->i >= s->end : it->i <= s->end) { return NULL; }
+      x = lval_num(it->i);
+      it->i += s->step;
+      return x;
+
+    case LSEQ_ITERATE:
+      if (!it->cur) {
+        it->cur = lval_copy(s->init);
+      } else {
+        it->frame->cell[0] = it->cur;
+        x = lval_apply(e, it->func, it->frame);
+        if (x->type == LVAL_ERR) { return x; }
+
+        lval_del(it->cur);
+        it->cur = x;
+      }
+      return lval_copy(it->cur);
+
+    case LSEQ_MAP:
+      x = lseq_next(e, it->src);
+      if (!x || x->type == LVAL_ERR) { return x; }
+
+      it->frame->cell[0] = x;
+      lval* y = lval_apply(e, it->func, it->frame);
+      lval_del(x);
+      return y;
+
+    case LSEQ_FILTER:
+      while ((x = lseq_next(e, it->src)) && x->type != LVAL_ERR) {
+        it->frame->cell[0] = x;
+        lval* keep = lval_apply(e, it->func, it->frame);
+
+        if (keep->type != LVAL_NUM) {
+          lval* err = keep->type == LVAL_ERR ? keep : lval_err("Function "
+            "'filter' predicate returned wrong type. Got %s, Expected %s.",
+            ltype_name(keep->type), ltype_name(LVAL_NUM));
+          if (err != keep) { lval_del(keep); }
+          lval_del(x);
+          return err;
+        }
+
+        int kept = keep->num != 0;
+        lval_del(keep);
+        if (kept) { return x; }
+
+        lval_del(x);
+      }
+      return x;
+
+    case LSEQ_TAKE:
+      if (it->i >= s->end) { return NULL; }
+      it->i++;
+      return lseq_next(e, it->src);
+  }
+
+  return NULL;
+}
+
+// work stealing pool behind pmap, preduce and par, one per interpreter.
+// every thread has its own deque of tasks. it pushes and pops its own work
+// at the bottom while idle threads steal from the top of everyone else's,
+// and a thread waiting on its tasks keeps running whatever it can find
+typedef void (*ltask)(void* ctx, int i, int worker);
+
+typedef struct {
+  ltask task;
+  void* ctx;
+  int i;
+  // tasks of one lpool_run left to finish, NULL for lpool_spawn
+  int* left;
+} lwork;
+
+typedef struct {
+  pthread_mutex_t lock;
+  lwork* items;
+  int top;
+  int bottom;
+  int cap;
+} ldeque;
+
+struct lpool {
+  int threads;
+  pthread_t* ids;
+  ldeque* deques;
+  linterp* owner;
+  // tasks sitting in any deque. wake is signalled under lock for new work,
+  // whenever a batch finishes and on quit
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int pending;
+  int quit;
+};
+
+typedef struct lpool lpool;
+
+// set while a thread is running pool tasks. def is refused there since the
+// global env is shared and unlocked
+static __thread int lworker = 0;
+
+// which deque belongs to this thread, the interpreter's own thread is 0
+static __thread int lworker_id = 0;
+
+void ldeque_push(ldeque* d, lwork w) {
+  pthread_mutex_lock(&d->lock);
+
+  if (d->bottom == d->cap) {
+    // slide down over the stolen slots before growing
+    if (d->top > 0) {
+      memmove(d->items, d->items + d->top, sizeof(lwork) * (d->bottom - d->top));
+      d->bottom -= d->top;
+      d->top = 0;
+    }
+
+    if (d->bottom == d->cap) {
+      d->cap = d->cap ? d->cap * 2 : 64;
+      d->items = realloc(d->items, sizeof(lwork) * d->cap);
+    }
+  }
+
+  d->items[d->bottom++] = w;
+  pthread_mutex_unlock(&d->lock);
+}
+
+// the owner takes from the bottom, newest first, thieves from the top
+int ldeque_take(ldeque* d, lwork* w, int steal) {
+  pthread_mutex_lock(&d->lock);
+
+  int found = d->top < d->bottom;
+  if (found) {
+    *w = steal ? d->items[d->top++] : d->items[--d->bottom];
+    if (d->top == d->bottom) { d->top = d->bottom = 0; }
+  }
+
+  pthread_mutex_unlock(&d->lock);
+
+  return found;
+}
+
+int lpool_find(lpool* p, int worker, lwork* w) {
+  int found = ldeque_take(&p->deques[worker], w, 0);
+
+  for (int i = 1; i < p->threads && !found; i++) {
+    found = ldeque_take(&p->deques[(worker + i) % p->threads], w, 1);
+  }
+
+  if (found) { __atomic_sub_fetch(&p->pending, 1, __ATOMIC_RELAXED); }
+
+  return found;
+}
+
+// counts one task off left and wakes the waiters once it reaches 0
+void lpool_done(lpool* p, int* left) {
+  if (__atomic_sub_fetch(left, 1, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_lock(&p->lock);
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+  }
+}
+
+void lpool_exec(lpool* p, lwork* w, int worker) {
+  w->task(w->ctx, w->i, worker);
+
+  if (w->left) { lpool_done(p, w->left); }
+}
+
+// what a worker thread is started with
+typedef struct {
+  lpool* p;
+  int id;
+} lpool_start;
+
+void* lpool_main(void* arg) {
+  lpool_start* start = arg;
+  lpool* p = start->p;
+  lwork w;
+
+  linterp_current = p->owner;
+  lworker = 1;
+  lworker_id = start->id;
+  free(start);
+
+  pthread_mutex_lock(&p->lock);
+
+  while (!p->quit) {
+    if (__atomic_load_n(&p->pending, __ATOMIC_RELAXED) == 0) {
+      pthread_cond_wait(&p->wake, &p->lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&p->lock);
+    while (lpool_find(p, lworker_id, &w)) { lpool_exec(p, &w, lworker_id); }
+    pthread_mutex_lock(&p->lock);
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  lval_free_drain();
+
+  return NULL;
+}
+
+lpool* lpool_new(linterp* owner) {
+  // one thread per core, the caller counts as one of them
+  long cores = 4;
+#ifdef _SC_NPROCESSORS_ONLN
+  cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  if (cores < 1) { cores = 1; }
+
+  lpool* p = malloc(sizeof(lpool));
+  p->threads = cores;
+  p->ids = malloc(sizeof(pthread_t) * cores);
+  p->deques = malloc(sizeof(ldeque) * cores);
+  p->owner = owner;
+  p->pending = 0;
+  p->quit = 0;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->wake, NULL);
+
+  for (int i = 0; i < p->threads; i++) {
+    pthread_mutex_init(&p->deques[i].lock, NULL);
+    p->deques[i].items = NULL;
+    p->deques[i].top = p->deques[i].bottom = p->deques[i].cap = 0;
+  }
+
+  // ids hand out 1 upwards, 0 is the interpreter's thread. workers wait
+  // on the lock, so they only see threads once it has its final value
+  pthread_mutex_lock(&p->lock);
+  for (int i = 1; i < p->threads; i++) {
+    lpool_start* start = malloc(sizeof(lpool_start));
+    start->p = p;
+    start->id = i;
+
+    if (pthread_create(&p->ids[i], NULL, lpool_main, start) != 0) {
+      // carry on with the workers we have
+      free(start);
+      for (int j = i; j < p->threads; j++) {
+        pthread_mutex_destroy(&p->deques[j].lock);
+      }
+      p->threads = i;
+    }
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  return p;
+}
+
+void lpool_del(lpool* p) {
+  if (!p) { return; }
+
+  // finish off anything still queued, like futures nobody waited on
+  lwork w;
+  while (lpool_find(p, lworker_id, &w)) { lpool_exec(p, &w, lworker_id); }
+
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+
+  for (int i = 1; i < p->threads; i++) { pthread_join(p->ids[i], NULL); }
+
+  for (int i = 0; i < p->threads; i++) {
+    pthread_mutex_destroy(&p->deques[i].lock);
+    free(p->deques[i].items);
+  }
+
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->wake);
+  free(p->deques);
+  free(p->ids);
+  free(p);
+}
+
+lpool* lpool_get(void) {
+  linterp* in = linterp_current;
+
+  if (!in->pool) { in->pool = lpool_new(in); }
+
+  return in->pool;
+}
+
+int lpool_threads(void) {
+  return lpool_get()->threads;
+}
+
+// helps out until left drops to 0, sleeping only when there is nothing left
+// anywhere to run
+void lpool_wait(lpool* p, int* left) {
+  int outer = lworker;
+  lwork w;
+
+  lworker = 1;
+
+  while (__atomic_load_n(left, __ATOMIC_ACQUIRE) > 0) {
+    if (lpool_find(p, lworker_id, &w)) {
+      lpool_exec(p, &w, lworker_id);
+      continue;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    while (__atomic_load_n(left, __ATOMIC_ACQUIRE) > 0 &&
+        __atomic_load_n(&p->pending, __ATOMIC_RELAXED) == 0) {
+      pthread_cond_wait(&p->wake, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+  }
+
+  lworker = outer;
+}
+
+// runs task for every i below count and waits for them all. tasks can call
+// lpool_run themselves. worker is a number below lpool_threads() naming the
+// thread the task runs on, so per-thread state in ctx can be indexed by it
+void lpool_run(ltask task, void* ctx, int count) {
+  lpool* p = lpool_get();
+  int outer = lworker;
+
+  lworker = 1;
+
+  if (p->threads == 1 || count == 1) {
+    for (int i = 0; i < count; i++) { task(ctx, i, lworker_id); }
+    lworker = outer;
+    return;
+  }
+
+  int left = count;
+  ldeque* d = &p->deques[lworker_id];
+
+  // counted before they're pushed so pending never dips below zero
+  __atomic_add_fetch(&p->pending, count, __ATOMIC_RELAXED);
+
+  // pushed in reverse so popping our own bottom runs them in order
+  for (int i = count - 1; i >= 0; i--) {
+    lwork w = { task, ctx, i, &left };
+    ldeque_push(d, w);
+  }
+
+  pthread_mutex_lock(&p->lock);
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+
+  lworker = outer;
+  lpool_wait(p, &left);
+}
+
+// queues a task to run in the background without waiting for it
+void lpool_spawn(ltask task, void* ctx) {
+  lpool* p = lpool_get();
+  lwork w = { task, ctx, 0, NULL };
+
+  __atomic_add_fetch(&p->pending, 1, __ATOMIC_RELAXED);
+  ldeque_push(&p->deques[lworker_id], w);
+
+  pthread_mutex_lock(&p->lock);
+  pthread_cond_broadcast(&p->wake);
+  pthread_mutex_unlock(&p->lock);
+}
+
+lval* lval_eval_call(lenv* e, lval* v);
+
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+  for (int i = 0; i < v->count; i++) {
+    v->cell[i] = lval_eval(e, v->cell[i]);
+  }
+
+  return lval_eval_call(e, v);
+}
+
+// the second half of evaluating an S-Expression, once its cells have been
+// evaluated, which par shares
+lval* lval_eval_call(lenv* e, lval* v) {
+  for (int i = 0; i < v->count; i++) {
+    if (v->cell[i]->type == LVAL_ERR) {
+      return lval_take(v, i);
+    }
+  }
+
+  if (v->count == 0) { return v; }
+  if (v->count == 1) { return lval_take(v, 0); }
+
+  lval* f = lval_pop(v, 0);
+
+  if (f->type != LVAL_FUN) {
+    lval* err = lval_err("S-Expression starts with incorrect type. "
+      "got %s, expected %s.",
+      ltype_name(f->type), ltype_name(LVAL_FUN));
+
+    lval_del(f);
+    lval_del(v);
+
+    return err;
+  }
+
+  lval* result = lval_call(e, f, v);
+  lval_del(f);
+
+  return result;
+}
+
+lenv* lenv_new(void) {
+  lenv* e = malloc(sizeof(lenv));
+  e->par = NULL;
+  e->count = 0;
+  e->syms = NULL;
+  e->vals = NULL;
+
+  return e;
+};
+
+void lenv_del(lenv* e) {
+  for (int i = 0; i < e->count; i++) {
+    free(e->syms[i]);
+    lval_del(e->vals[i]);
+  }
+  free(e->syms);
+  free(e->vals);
+  free(e);
+}
+
+// locks the interpreter's env if e is it and futures might be reading it,
+// returning whether it did
+int lenv_lock(lenv* e, int write) {
+  linterp* in = linterp_current;
+
+  if (!in || e != in->env || (!write && !lworker)) { return 0; }
+  if (__atomic_load_n(&in->futures, __ATOMIC_ACQUIRE) == 0) { return 0; }
+
+  if (write) {
+    pthread_rwlock_wrlock(&in->lock);
+  } else {
+    pthread_rwlock_rdlock(&in->lock);
+  }
+
+  return 1;
+}
+
+void lenv_unlock(int locked) {
+  if (locked) { pthread_rwlock_unlock(&linterp_current->lock); }
+}
+
+lval* lenv_get(lenv* e, lval* k) {
+  int locked = lenv_lock(e, 0);
+
+  for (int i = 0; i < e->count; i++) {
+    if (strcmp(e->syms[i], k->sym) == 0) {
+      lval* v = lval_copy(e->vals[i]);
+      lenv_unlock(locked);
+
+      return v;
+    }
+  }
+
+  lenv_unlock(locked);
+
+  if (e->par) {
+    return lenv_get(e->par, k);
+  } else {
+    return lval_err("Unbound Symbol '%s'", k->sym);
+  }
+}
+
+void lenv_put(lenv* e, lval* k, lval* v) {
+  int locked = lenv_lock(e, 1);
+
+  for (int i = 0; i < e->count; i++) {
+    if (strcmp(e->syms[i], k->sym) == 0) {
+      lval_del(e->vals[i]);
+      e->vals[i] = lval_copy(v);
+      lenv_unlock(locked);
+
+      return;
+    }
+  }
+
+  e->count++;
+  e->vals = realloc(e->vals, sizeof(lval*) * e->count);
+  e->syms = realloc(e->syms, sizeof(char*) * e->count);
+
+  e->vals[e->count - 1] = lval_copy(v);
+  e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
+  strcpy(e->syms[e->count - 1], k->sym);
+
+  lenv_unlock(locked);
+}
+
+void lenv_def(lenv* e, lval* k, lval* v) {
+  while (e->par) {
+    e = e->par;
+  }
+
+  lenv_put(e, k, v);
+}
+
+lenv* lenv_copy(lenv* e) {
+  lenv* n = malloc(sizeof(lenv));
+
+  n->par = e->par;
+  n->count = e->count;
+  n->syms = malloc(sizeof(char*) * n->count);
+  n->vals = malloc(sizeof(lval*) * n->count);
+
+  for (int i = 0; i < e->count; i++) {
+    n->syms[i] = malloc(strlen(e->syms[i]) + 1);
+    strcpy(n->syms[i], e->syms[i]);
+    n->vals[i] = lval_copy(e->vals[i]);
+  }
+
+  return n;
+}
+
+// a flat copy of every binding visible from e up to stop, inner ones
+// shadowing outer ones, in front of stop itself. for work that carries on
+// after e has moved on
+lenv* lenv_snapshot(lenv* e, lenv* stop) {
+  lenv* n = lenv_new();
+  n->par = stop;
+
+  for (; e && e != stop; e = e->par) {
+    for (int i = 0; i < e->count; i++) {
+      int seen = 0;
+      for (int j = 0; j < n->count && !seen; j++) {
+        seen = strcmp(n->syms[j], e->syms[i]) == 0;
+      }
+      if (seen) { continue; }
+
+      n->count++;
+      n->syms = realloc(n->syms, sizeof(char*) * n->count);
+      n->vals = realloc(n->vals, sizeof(lval*) * n->count);
+      n->syms[n->count - 1] = malloc(strlen(e->syms[i]) + 1);
+      strcpy(n->syms[n->count - 1], e->syms[i]);
+      n->vals[n->count - 1] = lval_copy(e->vals[i]);
+    }
+  }
+
+  return n;
+}
+
+void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
+  lval* k = lval_sym(name);
+  lval* v = lval_fun(func);
+
+  lenv_put(e, k, v);
+  lval_del(k);
+  lval_del(v);
+}
+
+lval* builtin_var(lenv* e, lval* a, char* func) {
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, func);
+
+  lval* syms = a->cell[0];
+
+  for (int i = 0; i < syms->count; i++) {
+    LASSERT(a, syms->cell[i]->type == LVAL_SYM,
+      "Funcion %s cannot define non-symbol",
+      ltype_name(syms->cell[i]->type));
+  }
+
+  // value indicies are all symbol indicies + 1 b/c first index of values is 
+  // symbols qexpr
+  LASSERT(a, syms->count == a->count - 1,
+    "Function def cannot define inequal number of values to symbols. "
+    "Got %i symbols and %i values.",
+    syms->count, a->count - 1);
+
+  for (int i = 0; i < syms->count; i++) {
+
+    if (strcmp(func, "def") == 0) {
+      lenv_def(e, syms->cell[i], a->cell[i + 1]);
+    }
+
+    if (strcmp(func, "=") == 0) {
+      lenv_put(e, syms->cell[i], a->cell[i + 1]);
+    }
+  }
+
+  lval_del(a);
+
+  return lval_sexpr();
+}
+
+lval* builtin_def(lenv* e, lval* a) {
+  LASSERT(a, !lworker,
+    "Function 'def' cannot be used inside pmap, preduce, par or future.");
+
+  return builtin_var(e, a, "def");
+}
+
+lval* builtin_put(lenv* e, lval* a) {
+  return builtin_var(e, a, "=");
+}
+
+// wraps the sequence in a as a lazy map or filter stage over a's function
+lval* lval_seq_stage(lval* a, int kind) {
+  lseq* s = lseq_new(kind, a->cell[1]->seq);
+  LREF_INC(s->src->refs);
+  s->func = lval_pop(a, 0);
+  lval_del(a);
+
+  return lval_seq(s);
+}
+
+lval* builtin_map(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "map");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUN, "map");
+
+  if (a->cell[1]->type == LVAL_SEQ) { return lval_seq_stage(a, LSEQ_MAP); }
+
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_QEXPR, "map");
+
+  lval* f = a->cell[0];
+  lval* list = a->cell[1];
+  lval* frame = lval_frame(1);
+
+  for (int i = 0; i < list->count; i++) {
+    frame->cell[0] = list->cell[i];
+    lval* x = lval_apply(e, f, frame);
+
+    if (x->type == LVAL_ERR) {
+      lval_frame_del(frame);
+      lval_del(a);
+      return x;
+    }
+
+    // results replace the elements in place so no second list is built
+    lval_del(list->cell[i]);
+    list->cell[i] = x;
+  }
+
+  lval_frame_del(frame);
+
+  return lval_take(a, 1);
+}
+
+lval* builtin_filter(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "filter");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUN, "filter");
+
+  if (a->cell[1]->type == LVAL_SEQ) { return lval_seq_stage(a, LSEQ_FILTER); }
+
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_QEXPR, "filter");
+
+  lval* f = a->cell[0];
+  lval* list = a->cell[1];
+  lval* frame = lval_frame(1);
+  lval* err = NULL;
+
+  // kept elements get compacted to the front of the list as we go
+  int kept = 0;
+  int i;
+
+  for (i = 0; i < list->count; i++) {
+    frame->cell[0] = list->cell[i];
+    lval* x = lval_apply(e, f, frame);
+
+    if (x->type != LVAL_NUM) {
+      err = x->type == LVAL_ERR ? x : lval_err("Function 'filter' predicate "
+        "returned wrong type. Got %s, Expected %s.",
+        ltype_name(x->type), ltype_name(LVAL_NUM));
+      if (err != x) { lval_del(x); }
+      break;
+    }
+
+    if (x->num) {
+      list->cell[kept++] = list->cell[i];
+    } else {
+      lval_del(list->cell[i]);
+    }
+
+    lval_del(x);
+  }
+
+  // on error slide the unvisited elements down so the list can be deleted
+  memmove(&list->cell[kept], &list->cell[i],
+    sizeof(lval*) * (list->count - i));
+  list->count = kept + list->count - i;
+
+  lval_frame_del(frame);
+
+  if (err) {
+    lval_del(a);
+    return err;
+  }
+
+  return lval_take(a, 1);
+}
+
+lval* lval_seq_fold(lenv* e, lval* a) {
+  lval* f = a->cell[0];
+  lval* acc = a->cell[1];
+  lseq_it* it = lseq_it_new(a->cell[2]->seq);
+  lval* frame = lval_frame(2);
+  lval* x;
+
+  a->cell[1] = lval_sexpr();
+
+  while ((x = lseq_next(e, it))) {
+    if (x->type == LVAL_ERR) {
+      lval_del(acc);
+      acc = x;
+      break;
+    }
+
+    frame->cell[0] = acc;
+    frame->cell[1] = x;
+
+    lval* y = lval_apply(e, f, frame);
+    lval_del(acc);
+    lval_del(x);
+    acc = y;
+
+    if (acc->type == LVAL_ERR) { break; }
+  }
+
+  lval_frame_del(frame);
+  lseq_it_del(it);
+  lval_del(a);
+
+  return acc;
+}
+
+lval* lval_fold(lenv* e, lval* a, char* name, int right) {
+  LASSERT_ARGS(a, 3, name);
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUN, name);
+
+  // only foldl makes sense on a sequence, foldr would need all of it first
+  if (!right && a->cell[2]->type == LVAL_SEQ) { return lval_seq_fold(e, a); }
+
+  LASSERT_TYPE(a, a->cell[2]->type, LVAL_QEXPR, name);
+
+  lval* f = a->cell[0];
+  lval* list = a->cell[2];
+  lval* acc = a->cell[1];
+  lval* frame = lval_frame(2);
+
+  // the initial value stays owned by a until it gets replaced
+  a->cell[1] = lval_sexpr();
+
+  for (int i = 0; i < list->count; i++) {
+    // foldl calls (f acc x) front to back, foldr calls (f x acc) back to front
+    if (right) {
+      frame->cell[0] = list->cell[list->count - 1 - i];
+      frame->cell[1] = acc;
+    } else {
+      frame->cell[0] = acc;
+      frame->cell[1] = list->cell[i];
+    }
+
+    lval* x = lval_apply(e, f, frame);
+    lval_del(acc);
+    acc = x;
+
+    if (acc->type == LVAL_ERR) { break; }
+  }
+
+  lval_frame_del(frame);
+  lval_del(a);
+
+  return acc;
+}
+
+lval* builtin_foldl(lenv* e, lval* a) {
+  return lval_fold(e, a, "foldl", 0);
+}
+
+lval* builtin_foldr(lenv* e, lval* a) {
+  return lval_fold(e, a, "foldr", 1);
+}
+
+lval* builtin_for_each(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "for-each");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUN, "for-each");
+
+  if (a->cell[1]->type == LVAL_SEQ) {
+    lseq_it* it = lseq_it_new(a->cell[1]->seq);
+    lval* frame = lval_frame(1);
+    lval* x;
+
+    while ((x = lseq_next(e, it)) && x->type != LVAL_ERR) {
+      frame->cell[0] = x;
+      lval* y = lval_apply(e, a->cell[0], frame);
+      lval_del(x);
+
+      if (y->type == LVAL_ERR) { x = y; break; }
+      lval_del(y);
+    }
+
+    lval_frame_del(frame);
+    lseq_it_del(it);
+    lval_del(a);
+
+    return x ? x : lval_sexpr();
+  }
+
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_QEXPR, "for-each");
+
+  lval* f = a->cell[0];
+  lval* list = a->cell[1];
+  lval* frame = lval_frame(1);
+
+  for (int i = 0; i < list->count; i++) {
+    frame->cell[0] = list->cell[i];
+    lval* x = lval_apply(e, f, frame);
+
+    if (x->type == LVAL_ERR) {
+      lval_frame_del(frame);
+      lval_del(a);
+      return x;
+    }
+
+    lval_del(x);
+  }
+
+  lval_frame_del(frame);
+  lval_del(a);
+
+  return lval_sexpr();
+}
+
+lval* builtin_range(lenv* e, lval* a) {
+  LASSERT(a, a->count >= 1 && a->count <= 3, "Function 'range' passed %i "
+    "arguments. Expected 1 to 3.", a->count);
+
+  for (int i = 0; i < a->count; i++) {
+    LASSERT_TYPE(a, a->cell[i]->type, LVAL_NUM, "range");
+  }
+
+  // (range end), (range start end) or (range start end step)
+  lseq* s = lseq_new(LSEQ_RANGE, NULL);
+  s->start = a->count > 1 ? a->cell[0]->num : 0;
+  s->end = a->count > 1 ? a->cell[1]->num : a->cell[0]->num;
+  s->step = a->count > 2 ? a->cell[2]->num : 1;
+
+  if (s->step == 0) {
+    lseq_release(s);
+    LASSERT(a, 0, "Function 'range' passed a step of 0.");
+  }
+
+  lval_del(a);
+
+  return lval_seq(s);
+}
+
+lval* builtin_iterate(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "iterate");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUN, "iterate");
+
+  // x, (f x), (f (f x)) ... forever, so it wants a take somewhere after it
+  lseq* s = lseq_new(LSEQ_ITERATE, NULL);
+  s->func = lval_pop(a, 0);
+  s->init = lval_pop(a, 0);
+  lval_del(a);
+
+  return lval_seq(s);
+}
+
+lval* builtin_collect(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "collect");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_SEQ, "collect");
+
+  lseq_it* it = lseq_it_new(a->cell[0]->seq);
+  lval* list = lval_qexpr();
+  lval* x;
+  int cap = 0;
+
+  // grow by doubling rather than one realloc per element like lval_add
+  while ((x = lseq_next(e, it))) {
+    if (x->type == LVAL_ERR) {
+      lval_del(list);
+      list = x;
+      break;
+    }
+
+    if (list->count == cap) {
+      cap = cap ? cap * 2 : 16;
+      list->cell = realloc(list->cell, sizeof(lval*) * cap);
+    }
+    list->cell[list->count++] = x;
+  }
+
+  if (list->type == LVAL_QEXPR && list->count) {
+    list->cell = realloc(list->cell, sizeof(lval*) * list->count);
+  }
+
+  lseq_it_del(it);
+  lval_del(a);
+
+  return list;
+}
+
+// shared state for one pmap or preduce. lval_apply rewires the function's
+// env on every call so each thread gets its own copy of f
+typedef struct {
+  lenv* env;
+  lval** funcs;
+  lval* list;
+  // preduce folds chunks of this many elements, one result per chunk
+  int chunk;
+  lval** results;
+} lpar;
+
+void lpar_init(lpar* p, lenv* e, lval* f, lval* list, int results) {
+  int threads = lpool_threads();
+
+  p->env = e;
+  p->funcs = malloc(sizeof(lval*) * threads);
+  p->list = list;
+  p->chunk = 1;
+  p->results = malloc(sizeof(lval*) * results);
+
+  for (int i = 0; i < threads; i++) { p->funcs[i] = lval_copy(f); }
+}
+
+// the results themselves are left to the caller
+void lpar_del(lpar* p) {
+  for (int i = 0; i < lpool_threads(); i++) { lval_del(p->funcs[i]); }
+
+  free(p->funcs);
+  free(p->results);
+}
+
+void lpar_map(void* ctx, int i, int worker) {
+  lpar* p = ctx;
+  lval* frame = lval_frame(1);
+
+  frame->cell[0] = p->list->cell[i];
+  p->results[i] = lval_apply(p->env, p->funcs[worker], frame);
+
+  lval_frame_del(frame);
+}
+
+lval* builtin_pmap(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "pmap");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUN, "pmap");
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_QEXPR, "pmap");
+
+  lval* list = a->cell[1];
+  lpar p;
+
+  lpar_init(&p, e, a->cell[0], list, list->count);
+  lpool_run(lpar_map, &p, list->count);
+
+  // the results come back in order, swap them in like map does
+  for (int i = 0; i < list->count; i++) {
+    lval* x = p.results[i];
+    p.results[i] = list->cell[i];
+    list->cell[i] = x;
+  }
+
+  for (int i = 0; i < list->count; i++) { lval_del(p.results[i]); }
+
+  lval* err = NULL;
+  for (int i = 0; i < list->count && !err; i++) {
+    if (list->cell[i]->type == LVAL_ERR) { err = lval_pop(list, i); }
+  }
+
+  lpar_del(&p);
+
+  if (err) {
+    lval_del(a);
+    return err;
+  }
+
+  return lval_take(a, 1);
+}
+
+void lpar_reduce(void* ctx, int i, int worker) {
+  lpar* p = ctx;
+  lval* f = p->funcs[worker];
+  lval* frame = lval_frame(2);
+
+  int start = i * p->chunk;
+  int end = start + p->chunk;
+  if (end > p->list->count) { end = p->list->count; }
+
+  lval* acc = lval_copy(p->list->cell[start]);
+
+  for (int j = start + 1; j < end && acc->type != LVAL_ERR; j++) {
+    frame->cell[0] = acc;
+    frame->cell[1] = p->list->cell[j];
+
+    lval* x = lval_apply(p->env, f, frame);
+    lval_del(acc);
+    acc = x;
+  }
+
+  p->results[i] = acc;
+  lval_frame_del(frame);
+}
+
+lval* builtin_preduce(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 3, "preduce");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUN, "preduce");
+  LASSERT_TYPE(a, a->cell[2]->type, LVAL_QEXPR, "preduce");
+
+  lval* list = a->cell[2];
+  if (list->count == 0) { return lval_take(a, 1); }
+
+  // f has to be associative. chunks get folded in parallel, then the
+  // chunk results are folded onto the initial value in order
+  int threads = lpool_threads();
+  int chunks = threads * 4 < list->count ? threads * 4 : list->count;
+  int chunk = (list->count + chunks - 1) / chunks;
+  chunks = (list->count + chunk - 1) / chunk;
+
+  lpar p;
+  lpar_init(&p, e, a->cell[0], list, chunks);
+  p.chunk = chunk;
+
+  lpool_run(lpar_reduce, &p, chunks);
+
+  lval* acc = a->cell[1];
+  a->cell[1] = lval_sexpr();
+
+  lval* frame = lval_frame(2);
+  for (int i = 0; i < chunks && acc->type != LVAL_ERR; i++) {
+    if (p.results[i]->type == LVAL_ERR) {
+      lval_del(acc);
+      acc = lval_copy(p.results[i]);
+      break;
+    }
+
+    frame->cell[0] = acc;
+    frame->cell[1] = p.results[i];
+
+    lval* x = lval_apply(e, p.funcs[0], frame);
+    lval_del(acc);
+    acc = x;
+  }
+  lval_frame_del(frame);
+
+  for (int i = 0; i < chunks; i++) { lval_del(p.results[i]); }
+  lpar_del(&p);
+
+  lval_del(a);
+
+  return acc;
+}
+
+typedef struct {
+  lenv* env;
+  lval* expr;
+  // cells of expr to evaluate, by index
+  int* cells;
+} lpar_eval;
+
+void lpar_eval_cell(void* ctx, int i, int worker) {
+  lpar_eval* p = ctx;
+  int c = p->cells[i];
+
+  // a scope of its own so = inside one argument can't race the others
+  lenv* scope = lenv_new();
+  scope->par = p->env;
+
+  p->expr->cell[c] = lval_eval(scope, p->expr->cell[c]);
+  lenv_del(scope);
+}
+
+lval* builtin_par(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "par");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "par");
+
+  // (par {f x y}) evaluates like (f x y) but with the arguments in parallel
+  lval* v = lval_take(a, 0);
+  v->type = LVAL_SEXPR;
+
+  lpar_eval p = { e, v, malloc(sizeof(int) * (v->count ? v->count : 1)) };
+  int n = 0;
+
+  // only calls are worth a task, symbols and literals are done in line
+  for (int i = 0; i < v->count; i++) {
+    if (i > 0 && v->cell[i]->type == LVAL_SEXPR && v->cell[i]->count > 0) {
+      p.cells[n++] = i;
+    } else {
+      v->cell[i] = lval_eval(e, v->cell[i]);
+    }
+  }
+
+  // a single task still goes through lpool_run, which runs it in line but
+  // under the same rules as the rest
+  if (n > 0) { lpool_run(lpar_eval_cell, &p, n); }
+
+  free(p.cells);
+
+  return lval_eval_call(e, v);
+}
+
+void lpromise_run(void* ctx, int i, int worker) {
+  lpromise* p = ctx;
+
+  // nobody else touches expr or env, and result isn't read until left is 0
+  p->result = lval_eval(p->env, p->expr);
+  p->expr = NULL;
+  lenv_del(p->env);
+  p->env = NULL;
+  __atomic_sub_fetch(&linterp_current->futures, 1, __ATOMIC_RELEASE);
+
+  lpool_done(lpool_get(), &p->left);
+  lpromise_release(p);
+}
+
+lval* builtin_future(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "future");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "future");
+
+  // evaluated like eval would, but on a pool thread. the local frames are
+  // copied since they may be gone by the time it runs, the globals are
+  // shared and locked while it does
+  linterp* in = linterp_current;
+  lpromise* p = malloc(sizeof(lpromise));
+  p->refs = 2;
+  p->left = 1;
+  p->expr = lval_take(a, 0);
+  p->expr->type = LVAL_SEXPR;
+  p->env = lenv_snapshot(e, in->env);
+  p->result = NULL;
+
+  __atomic_add_fetch(&in->futures, 1, __ATOMIC_ACQ_REL);
+
+  lpool_spawn(lpromise_run, p);
+
+  return lval_future(p);
+}
+
+// waits for f and takes its result out. the last reference to a future
+// hands over the result itself, otherwise it gets copied
+lval* lval_future_result(lval* f) {
+  lpromise* p = f->promise;
+
+  lpool_wait(lpool_get(), &p->left);
+
+  lval* x;
+  if (__atomic_load_n(&p->refs, __ATOMIC_ACQUIRE) == 1) {
+    x = p->result;
+    p->result = NULL;
+  } else {
+    x = lval_copy(p->result);
+  }
+
+  lval_del(f);
+
+  return x;
+}
+
+lval* builtin_deref(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "deref");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUTURE, "deref");
+
+  return lval_future_result(lval_take(a, 0));
+}
+
+lval* builtin_await(lenv* e, lval* a) {
+  LASSERT(a, a->count > 0, "Function 'await' passed no arguments.");
+
+  for (int i = 0; i < a->count; i++) {
+    LASSERT_TYPE(a, a->cell[i]->type, LVAL_FUTURE, "await");
+  }
+
+  // one future gives its value, several give a list of them in order
+  if (a->count == 1) { return lval_future_result(lval_take(a, 0)); }
+
+  for (int i = 0; i < a->count; i++) {
+    a->cell[i] = lval_future_result(a->cell[i]);
+  }
+  a->type = LVAL_QEXPR;
+
+  return a;
+}
+
+// green threads are coroutines with their own stacks, switched between
+// with ucontext on the interpreter's own thread. nothing runs until the
+// thread that is running blocks on a channel or yields, and each
+// linterp_eval finishes by running them until they're all parked or done.
+// their stacks are sized like a thread's, from RLIMIT_STACK or else
+// LGREEN_STACK, and only use memory as they grow. a guard page at the
+// bottom catches anything that runs off the end, and evaluation gives up
+// with an error once it gets within LGREEN_STACK_SPARE of it
+enum {
+  LGREEN_STACK = 8 * 1024 * 1024,
+  LGREEN_STACK_SPARE = 256 * 1024
+};
+
+struct lgreen {
+  ucontext_t ctx;
+  char* stack;
+  size_t stack_size;
+  // below this the thread is out of stack
+  char* limit;
+  lval* expr;
+  lenv* env;
+  int done;
+  // link in the ready queue or a channel queue
+  struct lgreen* next;
+  // every thread that hasn't finished, for linterp_del
+  struct lgreen* sibling;
+};
+
+typedef struct lgreen lgreen;
+
+struct lsched {
+  // the interpreter's own thread, which is where the scheduling happens
+  lgreen main;
+  lgreen* current;
+  lqueue ready;
+  lgreen* all;
+  int main_woken;
+  // set while linterp_del winds down the threads still parked
+  int cancel;
+  // what a thread that ran out of stack couldn't free, freed back on the
+  // interpreter's thread
+  lval* dead;
+  // errors from threads that failed, kept until linterp_errors takes them
+  lval* errors;
+};
+
+typedef struct lsched lsched;
+
+void lqueue_push(lqueue* q, lgreen* g) {
+  g->next = NULL;
+  if (q->tail) { q->tail->next = g; } else { q->head = g; }
+  q->tail = g;
+}
+
+lgreen* lqueue_pop(lqueue* q) {
+  lgreen* g = q->head;
+
+  if (g) {
+    q->head = g->next;
+    if (!q->head) { q->tail = NULL; }
+  }
+
+  return g;
+}
+
+void lqueue_remove(lqueue* q, lgreen* g) {
+  lgreen* prev = NULL;
+
+  for (lgreen* x = q->head; x; prev = x, x = x->next) {
+    if (x != g) { continue; }
+
+    if (prev) { prev->next = x->next; } else { q->head = x->next; }
+    if (q->tail == x) { q->tail = prev; }
+    return;
+  }
+}
+
+lsched* lsched_get(void) {
+  linterp* in = linterp_current;
+
+  if (!in->sched) {
+    lsched* s = malloc(sizeof(lsched));
+    s->current = &s->main;
+    s->ready.head = s->ready.tail = NULL;
+    s->all = NULL;
+    s->main_woken = 0;
+    s->cancel = 0;
+    s->dead = NULL;
+    s->errors = NULL;
+    in->sched = s;
+  }
+
+  return in->sched;
+}
+
+void lgreen_del(lgreen* g) {
+  if (g->expr) { lval_del(g->expr); }
+  if (g->env) { lenv_del(g->env); }
+  munmap(g->stack, g->stack_size);
+  free(g);
+}
+
+void lgreen_entry(void) {
+  lsched* s = linterp_current->sched;
+  lgreen* g = s->current;
+
+  // expr going NULL marks the thread as started
+  lval* x = g->expr;
+  g->expr = NULL;
+  x = lval_eval(g->env, x);
+
+  // nobody is around to take the result, but errors shouldn't vanish
+  if (x->type == LVAL_ERR && !s->cancel) {
+    if (!s->errors) { s->errors = lval_qexpr(); }
+    lval_add(s->errors, x);
+  } else {
+    lval_del(x);
+  }
+
+  g->done = 1;
+  swapcontext(&g->ctx, &s->main.ctx);
+}
+
+// the running green thread's limit, NULL on the interpreter's thread
+static __thread char* lgreen_limit = NULL;
+
+size_t lgreen_stack_size(void) {
+  struct rlimit r;
+
+  if (getrlimit(RLIMIT_STACK, &r) == 0 && r.rlim_cur != RLIM_INFINITY &&
+      r.rlim_cur > 0) {
+    return r.rlim_cur;
+  }
+
+  return LGREEN_STACK;
+}
+
+// gets g ready to start in lgreen_entry on a stack of its own. 0 if there
+// was no room for the stack
+int lgreen_init(lgreen* g) {
+  // taken first so that nothing but g is live across it
+  getcontext(&g->ctx);
+
+  long page = sysconf(_SC_PAGESIZE);
+  size_t size = (lgreen_stack_size() + page - 1) / page * page + page;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+
+  char* stack = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (stack == MAP_FAILED) { return 0; }
+  mprotect(stack, page, PROT_NONE);
+
+  g->stack = stack;
+  g->stack_size = size;
+  g->limit = stack + page + LGREEN_STACK_SPARE;
+
+  g->ctx.uc_stack.ss_sp = stack + page;
+  g->ctx.uc_stack.ss_size = size - page;
+  g->ctx.uc_link = NULL;
+  makecontext(&g->ctx, lgreen_entry, 0);
+
+  return 1;
+}
+
+// switches from the interpreter's thread to g until it blocks or finishes
+void lsched_resume(lsched* s, lgreen* g) {
+  s->current = g;
+  lgreen_limit = g->limit;
+  swapcontext(&s->main.ctx, &g->ctx);
+  lgreen_limit = NULL;
+  s->current = &s->main;
+
+  if (s->dead) {
+    lval_del(s->dead);
+    s->dead = NULL;
+  }
+
+  if (!g->done) { return; }
+
+  for (lgreen** x = &s->all; *x; x = &(*x)->sibling) {
+    if (*x == g) { *x = g->sibling; break; }
+  }
+  lgreen_del(g);
+}
+
+void lsched_del(lsched* s) {
+  if (!s) { return; }
+
+  // threads that never started are just dropped. the rest get resumed
+  // with every channel operation failing, so they unwind and free what
+  // their stacks are holding on the way out
+  s->cancel = 1;
+
+  while (s->all) {
+    lgreen* g = s->all;
+
+    if (g->expr) {
+      s->all = g->sibling;
+      lgreen_del(g);
+    } else {
+      lsched_resume(s, g);
+    }
+  }
+
+  if (s->errors) { lval_del(s->errors); }
+  free(s);
+}
+
+// runs green threads until none of them can go any further
+void lsched_drain(lsched* s) {
+  lgreen* g;
+  while ((g = lqueue_pop(&s->ready))) { lsched_resume(s, g); }
+}
+
+void lsched_wake(lsched* s, lgreen* g) {
+  if (g == &s->main) {
+    s->main_woken = 1;
+  } else {
+    lqueue_push(&s->ready, g);
+  }
+}
+
+// parks whatever is running until someone wakes it. a green thread goes
+// back to the scheduler, the interpreter's thread runs the others until
+// it gets woken. 0 means that can never happen
+int lsched_block(lsched* s) {
+  lgreen* g = s->current;
+
+  if (s->cancel) { return 0; }
+
+  if (g != &s->main) {
+    swapcontext(&g->ctx, &s->main.ctx);
+    return !s->cancel;
+  }
+
+  s->main_woken = 0;
+  while (!s->main_woken) {
+    lgreen* t = lqueue_pop(&s->ready);
+    if (!t) { return 0; }
+    lsched_resume(s, t);
+  }
+
+  return 1;
+}
+
+lval* builtin_spawn(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "spawn");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "spawn");
+  LASSERT(a, !lworker,
+    "Function 'spawn' cannot be used inside pmap, preduce, par or future.");
+
+  lgreen* g = malloc(sizeof(lgreen));
+
+  if (!lgreen_init(g)) {
+    free(g);
+    lval_del(a);
+    return lval_err("Function 'spawn' could not get a stack for the thread.");
+  }
+
+  // locals are captured since the caller's scope may be gone by the time
+  // this runs, but defs still go to the real global env
+  g->expr = lval_take(a, 0);
+  g->expr->type = LVAL_SEXPR;
+  g->env = lenv_snapshot(e, linterp_current->env);
+  g->done = 0;
+
+  lsched* s = lsched_get();
+  g->sibling = s->all;
+  s->all = g;
+  lqueue_push(&s->ready, g);
+
+  return lval_sexpr();
+}
+
+lval* builtin_chan(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "chan");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_NUM, "chan");
+  LASSERT(a, a->cell[0]->num > 0,
+    "Function 'chan' needs a capacity of at least 1. Got %li.",
+    a->cell[0]->num);
+
+  lval* c = lval_chan(a->cell[0]->num);
+  lval_del(a);
+
+  return c;
+}
+
+#define LASSERT_GREEN(args, name) \
+  LASSERT(args, !lworker, "Function '%s' cannot be used inside pmap, " \
+    "preduce, par or future.", name);
+
+lval* builtin_send(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "send");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_CHAN, "send");
+  LASSERT_GREEN(a, "send");
+
+  lsched* s = lsched_get();
+  lchan* c = a->cell[0]->chan;
+
+  while (c->count == c->cap) {
+    lqueue_push(&c->senders, s->current);
+
+    if (!lsched_block(s)) {
+      lqueue_remove(&c->senders, s->current);
+      LASSERT(a, !s->cancel, "Green thread cancelled.");
+      LASSERT(a, 0, "Deadlock: 'send' on a full channel no one will recv from.");
+    }
+  }
+
+  c->items[(c->head + c->count++) % c->cap] = lval_pop(a, 1);
+
+  lgreen* g = lqueue_pop(&c->receivers);
+  if (g) { lsched_wake(s, g); }
+
+  lval_del(a);
+
+  return lval_sexpr();
+}
+
+lval* builtin_recv(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "recv");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_CHAN, "recv");
+  LASSERT_GREEN(a, "recv");
+
+  lsched* s = lsched_get();
+  lchan* c = a->cell[0]->chan;
+
+  while (c->count == 0) {
+    lqueue_push(&c->receivers, s->current);
+
+    if (!lsched_block(s)) {
+      lqueue_remove(&c->receivers, s->current);
+      LASSERT(a, !s->cancel, "Green thread cancelled.");
+      LASSERT(a, 0, "Deadlock: 'recv' on an empty channel no one will send to.");
+    }
+  }
+
+  lval* x = c->items[c->head];
+  c->head = (c->head + 1) % c->cap;
+  c->count--;
+
+  lgreen* g = lqueue_pop(&c->senders);
+  if (g) { lsched_wake(s, g); }
+
+  lval_del(a);
+
+  return x;
+}
+
+lval* builtin_yield(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "yield");
+  LASSERT_GREEN(a, "yield");
+
+  // (yield x) lets everything else that's ready have a turn, then gives x
+  lsched* s = lsched_get();
+
+  if (s->current == &s->main) {
+    lqueue q = s->ready;
+    s->ready.head = s->ready.tail = NULL;
+
+    lgreen* g;
+    while ((g = lqueue_pop(&q))) { lsched_resume(s, g); }
+  } else {
+    lqueue_push(&s->ready, s->current);
+    LASSERT(a, lsched_block(s), "Green thread cancelled.");
+  }
+
+  return lval_take(a, 0);
+}
+
+// comparators return <0, 0 or >0 like strcmp. ctx is whatever the sort
+// caller needs to do the comparison
+typedef int (*lcmp)(lval*, lval*, void*);
+
+int lval_cmp_num(lval* x, lval* y, void* ctx) {
+  return (x->num > y->num) - (x->num < y->num);
+}
+
+typedef struct {
+  lenv* env;
+  lval* func;
+  lval* frame;
+  lval* err;
+} lsort;
+
+// calls a lisp comparator through one frame shared by every comparison.
+// after the first error every comparison says equal so the sort just winds
+// down and the caller reports the error
+int lval_cmp_fun(lval* x, lval* y, void* ctx) {
+  lsort* s = ctx;
+
+  if (s->err) { return 0; }
+
+  s->frame->cell[0] = x;
+  s->frame->cell[1] = y;
+  lval* r = lval_apply(s->env, s->func, s->frame);
+
+  if (r->type != LVAL_NUM) {
+    s->err = r->type == LVAL_ERR ? r : lval_err("Sort comparator returned "
+      "wrong type. Got %s, Expected %s.",
+      ltype_name(r->type), ltype_name(LVAL_NUM));
+    if (s->err != r) { lval_del(r); }
+
+    return 0;
+  }
+
+  long n = r->num;
+  lval_del(r);
+
+  return (n > 0) - (n < 0);
+}
+
+enum { LSORT_SMALL = 16 };
+
+// stable, so merge sort uses it for its short runs as well
+void lval_insertion_sort(lval** v, int n, lcmp cmp, void* ctx) {
+  for (int i = 1; i < n; i++) {
+    lval* x = v[i];
+    int j = i;
+
+    while (j > 0 && cmp(v[j - 1], x, ctx) > 0) {
+      v[j] = v[j - 1];
+      j--;
+    }
+
+    v[j] = x;
+  }
+}
+
+void lval_sift_down(lval** v, int root, int n, lcmp cmp, void* ctx) {
+  while (2 * root + 1 < n) {
+    int child = 2 * root + 1;
+
+    if (child + 1 < n && cmp(v[child], v[child + 1], ctx) < 0) { child++; }
+    if (cmp(v[root], v[child], ctx) >= 0) { return; }
+
+    lval* t = v[root]; v[root] = v[child]; v[child] = t;
+    root = child;
+  }
+}
+
+void lval_heap_sort(lval** v, int n, lcmp cmp, void* ctx) {
+  for (int i = n / 2 - 1; i >= 0; i--) { lval_sift_down(v, i, n, cmp, ctx); }
+
+  for (int end = n - 1; end > 0; end--) {
+    lval* t = v[0]; v[0] = v[end]; v[end] = t;
+    lval_sift_down(v, 0, end, cmp, ctx);
+  }
+}
+
+// quicksort that hands over to heap sort once it has recursed too deep, so
+// nasty inputs are still n log n. small ranges finish with insertion sort
+void lval_introsort(lval** v, int n, int depth, lcmp cmp, void* ctx) {
+  while (n > LSORT_SMALL) {
+    if (depth-- == 0) {
+      lval_heap_sort(v, n, cmp, ctx);
+      return;
+    }
+
+    // median of three, which also leaves sentinels at both ends
+    int mid = (n - 1) / 2;
+    lval* t;
+    if (cmp(v[mid], v[0], ctx) < 0) { t = v[mid]; v[mid] = v[0]; v[0] = t; }
+    if (cmp(v[n - 1], v[0], ctx) < 0) { t = v[n - 1]; v[n - 1] = v[0]; v[0] = t; }
+    if (cmp(v[n - 1], v[mid], ctx) < 0) { t = v[n - 1]; v[n - 1] = v[mid]; v[mid] = t; }
+    lval* pivot = v[mid];
+
+    // the bounds checks only matter for comparators that aren't consistent
+    int i = -1;
+    int j = n;
+    while (1) {
+      do { i++; } while (i < n - 1 && cmp(v[i], pivot, ctx) < 0);
+      do { j--; } while (j > 0 && cmp(pivot, v[j], ctx) < 0);
+      if (i >= j) { break; }
+      t = v[i]; v[i] = v[j]; v[j] = t;
+    }
+    if (j > n - 2) { j = n - 2; }
+
+    // recurse into the smaller half and keep looping on the bigger one
+    int left = j + 1;
+    if (left < n - left) {
+      lval_introsort(v, left, depth, cmp, ctx);
+      v += left;
+      n -= left;
+    } else {
+      lval_introsort(v + left, n - left, depth, cmp, ctx);
+      n = left;
+    }
+  }
+
+  lval_insertion_sort(v, n, cmp, ctx);
+}
+
+// tmp needs room for n / 2 + 1 pointers and is shared by every level
+void lval_merge_sort(lval** v, lval** tmp, int n, lcmp cmp, void* ctx) {
+  if (n <= LSORT_SMALL) {
+    lval_insertion_sort(v, n, cmp, ctx);
+    return;
+  }
+
+  int half = n / 2;
+  lval_merge_sort(v, tmp, half, cmp, ctx);
+  lval_merge_sort(v + half, tmp, n - half, cmp, ctx);
+
+  // already in order, nothing to merge
+  if (cmp(v[half - 1], v[half], ctx) <= 0) { return; }
+
+  memcpy(tmp, v, sizeof(lval*) * half);
+
+  int i = 0;
+  int j = half;
+  int k = 0;
+  while (i < half && j < n) {
+    // only take from the right when strictly smaller to stay stable
+    v[k++] = cmp(v[j], tmp[i], ctx) < 0 ? v[j++] : tmp[i++];
+  }
+  while (i < half) { v[k++] = tmp[i++]; }
+}
+
+void lval_sort(lval* list, int stable, lcmp cmp, void* ctx) {
+  int n = list->count;
+  if (n < 2) { return; }
+
+  if (stable) {
+    lval** tmp = malloc(sizeof(lval*) * (n / 2 + 1));
+    lval_merge_sort(list->cell, tmp, n, cmp, ctx);
+    free(tmp);
+  } else {
+    int depth = 0;
+    for (int m = n; m > 1; m >>= 1) { depth += 2; }
+    lval_introsort(list->cell, n, depth, cmp, ctx);
+  }
+}
+
+lval* builtin_sort(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "sort");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, "sort");
+
+  lval* list = a->cell[0];
+  for (int i = 0; i < list->count; i++) {
+    LASSERT(a, list->cell[i]->type == LVAL_NUM,
+      "Function 'sort' can only sort Numbers. Got %s. "
+      "Use sort-by for anything else.", ltype_name(list->cell[i]->type));
+  }
+
+  // numbers never go near the evaluator, equal ones are indistinguishable
+  // so there is no need for the stable path either
+  lval_sort(list, 0, lval_cmp_num, NULL);
+
+  return lval_take(a, 0);
+}
+
+lval* lval_sort_by(lenv* e, lval* a, char* name, int stable) {
+  LASSERT_ARGS(a, 2, name);
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_FUN, name);
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_QEXPR, name);
+
+  lsort s;
+  s.env = e;
+  s.func = a->cell[0];
+  s.frame = lval_frame(2);
+  s.err = NULL;
+
+  lval_sort(a->cell[1], stable, lval_cmp_fun, &s);
+
+  lval_frame_del(s.frame);
+
+  if (s.err) {
+    lval_del(a);
+    return s.err;
+  }
+
+  return lval_take(a, 1);
+}
+
+// (sort-by f list) where (f x y) is negative when x goes before y
+lval* builtin_sort_by(lenv* e, lval* a) {
+  return lval_sort_by(e, a, "sort-by", 0);
+}
+
+lval* builtin_stable_sort_by(lenv* e, lval* a) {
+  return lval_sort_by(e, a, "stable-sort-by", 1);
+}
+
+// keys can be passed quoted like the names given to def, so {name} works
+// as well as a bare Number. unwraps the key in place
+int lval_dict_key(lval* a, int i) {
+  lval* k = a->cell[i];
+
+  if (k->type == LVAL_QEXPR && k->count == 1 && k->cell[0]->type == LVAL_SYM) {
+    a->cell[i] = lval_take(k, 0);
+    k = a->cell[i];
+  }
+
+  return lval_is_key(k);
+}
+
+#define LASSERT_KEY(args, i, name) \
+  LASSERT(args, lval_dict_key(args, i), "Function '%s' passed invalid key. " \
+    "Got %s, Expected Number, Symbol or String.", \
+    name, ltype_name(args->cell[i]->type));
+
+lval* builtin_dict(lenv* e, lval* a) {
+  // (dict {a 1 b 2}) reads the pairs from one list, which is also the only
+  // way to ask for an empty dict since (dict) on its own is just the builtin
+  if (a->count == 1 && a->cell[0]->type == LVAL_QEXPR) {
+    a = lval_take(a, 0);
+  }
+
+  LASSERT(a, a->count % 2 == 0,
+    "Function 'dict' needs key value pairs. Got %i arguments.", a->count);
+
+  for (int i = 0; i < a->count; i += 2) {
+    LASSERT_KEY(a, i, "dict");
+  }
+
+  lval* d = lval_dict();
+
+  // move the pairs straight into the table
+  for (int i = 0; i < a->count; i += 2) {
+    ldict_put(d->dict, a->cell[i], a->cell[i + 1]);
+  }
+
+  free(a->cell);
+  free(a);
+
+  return d;
+}
+
+lval* builtin_dict_get(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "dict-get");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_DICT, "dict-get");
+  LASSERT_KEY(a, 1, "dict-get");
+
+  ldict* d = a->cell[0]->dict;
+  lval* v;
+
+  if (!ldict_shared(d)) {
+    // the dict is ours to throw away, so unlink the value instead of copying
+    v = ldict_remove(d, a->cell[1]);
+  } else {
+    // it's still the table of some binding, so only the value is copied
+    v = ldict_get(d, a->cell[1]);
+    if (v) { v = lval_copy(v); }
+  }
+
+  if (!v) {
+    v = lval_err("Key not found in dictionary.");
+  }
+
+  lval_del(a);
+
+  return v;
+}
+
+lval* builtin_dict_put(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 3, "dict-put");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_DICT, "dict-put");
+  LASSERT_KEY(a, 1, "dict-put");
+
+  lval* d = a->cell[0];
+  ldict_put(ldict_own(d), a->cell[1], a->cell[2]);
+
+  free(a->cell);
+  free(a);
+
+  return d;
+}
+
+lval* builtin_dict_del(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "dict-del");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_DICT, "dict-del");
+  LASSERT_KEY(a, 1, "dict-del");
+
+  // deleting a missing key just leaves the dict as it is, shared or not
+  if (ldict_get(a->cell[0]->dict, a->cell[1])) {
+    lval_del(ldict_remove(ldict_own(a->cell[0]), a->cell[1]));
+  }
+
+  return lval_take(a, 0);
+}
+
+lval* builtin_dict_keys(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "dict-keys");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_DICT, "dict-keys");
+
+  ldict* d = a->cell[0]->dict;
+  lval* keys = lval_qexpr();
+  keys->cell = malloc(sizeof(lval*) * d->count);
+
+  for (int i = 0; i < d->slots; i++) {
+    if (d->keys[i]) { keys->cell[keys->count++] = lval_copy(d->keys[i]); }
+  }
+
+  lval_del(a);
+
+  return keys;
+}
+
+lval* builtin_dict_size(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "dict-size");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_DICT, "dict-size");
+
+  lval* n = lval_num(a->cell[0]->dict->count);
+  lval_del(a);
+
+  return n;
+}
+
+// takes ownership of k and v and gives back a new map, m keeps its version
+lval* lval_map_assoc(lval* m, lval* k, lval* v) {
+  int added = 0;
+  lhamt* root = lhamt_assoc(m->hamt, 0, lhleaf_new(lval_hash(k), k, v), &added);
+
+  return lval_map(root, m->count + added);
+}
+
+lval* builtin_hash_map(lenv* e, lval* a) {
+  // same shapes as dict, (hash-map {a 1 b 2}) or (hash-map {a} 1 {b} 2)
+  if (a->count == 1 && a->cell[0]->type == LVAL_QEXPR) {
+    a = lval_take(a, 0);
+  }
+
+  LASSERT(a, a->count % 2 == 0,
+    "Function 'hash-map' needs key value pairs. Got %i arguments.", a->count);
+
+  for (int i = 0; i < a->count; i += 2) {
+    LASSERT_KEY(a, i, "hash-map");
+  }
+
+  lval* m = lval_map(NULL, 0);
+
+  for (int i = 0; i < a->count; i += 2) {
+    lval* n = lval_map_assoc(m, a->cell[i], a->cell[i + 1]);
+    lval_del(m);
+    m = n;
+  }
+
+  free(a->cell);
+  free(a);
 
-  return lval_lambda(formals, body);
+  return m;
 }
 
-lval* lval_read_num(mpc_ast_t* t) {
-  errno = 0;
-  long x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ?
-    lval_num(x) : lval_err("invalid number");
+lval* builtin_assoc(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 3, "assoc");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_MAP, "assoc");
+  LASSERT_KEY(a, 1, "assoc");
+
+  lval* m = lval_map_assoc(a->cell[0], a->cell[1], a->cell[2]);
+
+  lval_del(a->cell[0]);
+  free(a->cell);
+  free(a);
+
+  return m;
 }
 
-lval* lval_read(mpc_ast_t* t) {
-//  printf("Tag: %s\n", t->tag);
-//  printf("Contents: %s\n", t->contents);
-//  printf("Number of children: %d\n", t->children_num);
+lval* builtin_dissoc(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "dissoc");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_MAP, "dissoc");
+  LASSERT_KEY(a, 1, "dissoc");
 
-  if (strstr(t->tag, "number")) { return lval_read_num(t); }
-  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+  lval* m = a->cell[0];
 
-  lval* v = NULL;
+  // like dict-del, a missing key leaves the map as it is
+  if (!m->hamt) { return lval_take(a, 0); }
 
-  if (strcmp(t->tag, ">") == 0) { 
-    v = lval_sexpr();
-  } else if (strstr(t->tag, "sexpr")) {
-    v = lval_sexpr();
-  } else if (strstr(t->tag, "qexpr")) {
-    v = lval_qexpr(); 
-  } else {
-    v = lval_err("idfk");
-  }
+  int removed = 0;
+  lhamt* root = lhamt_dissoc(m->hamt, 0, lval_hash(a->cell[1]), a->cell[1],
+    &removed);
+  lval* x = lval_map(root, m->count - removed);
 
-  for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "{") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, "}") == 0) { continue; }
-    if (strcmp(t->children[i]->tag, "regex") == 0) { continue; }
+  lval_del(a);
 
-    v = lval_add(v, lval_read(t->children[i]));
-  }
+  return x;
+}
+
+lval* builtin_get(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "get");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_MAP, "get");
+  LASSERT_KEY(a, 1, "get");
+
+  lval* v = lhamt_get(a->cell[0]->hamt, lval_hash(a->cell[1]), a->cell[1]);
+
+  // the value may be shared with other versions so hand out a copy
+  v = v ? lval_copy(v) : lval_err("Key not found in hash map.");
+  lval_del(a);
 
   return v;
 }
 
-lval* lval_call(lenv* e, lval* func, lval* args) {
-  if (func->builtin) {
-    return func->builtin(e, args);
-  }
-
-  int given = args->count;
-  int total = func->formals->count;
+lval* builtin_hash_map_size(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "hash-map-size");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_MAP, "hash-map-size");
 
-  while (args->count) {
-    if (func->formals->count == 0) {
-      lval_del(args);
-      return lval_err("Function passed too many arguments. "
-      "Got %i. Expected %i.", given, total);
-    }
+  lval* n = lval_num(a->cell[0]->count);
+  lval_del(a);
 
-    lval* sym = lval_pop(func->formals, 0);
-    lval* val = lval_pop(args, 0);
+  return n;
+}
 
-    lenv_put(func->env, sym, val);
-    lval_del(sym);
-    lval_del(val);
+lval* builtin_str_concat(lenv* e, lval* a) {
+  for (int i = 0; i < a->count; i++) {
+    LASSERT_TYPE(a, a->cell[i]->type, LVAL_STR, "str-concat");
   }
 
-  lval_del(args);
+  int total = 0;
+  for (int i = 0; i < a->count; i++) { total += a->cell[i]->len; }
 
-  if (func->formals->count == 0) {
-    func->env->par = e;
+  // build into one buffer of the final size
+  char* s = malloc(total + 1);
+  int n = 0;
 
-    return builtin_eval(func->env,
-      lval_add(lval_sexpr(), lval_copy(func->body)));
-  } else {
-    return lval_copy(func);
+  for (int i = 0; i < a->count; i++) {
+    memcpy(s + n, lval_str_ptr(a->cell[i]), a->cell[i]->len);
+    n += a->cell[i]->len;
   }
+
+  lval* x = lval_str(s, total);
+  free(s);
+  lval_del(a);
+
+  return x;
 }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-  for (int i = 0; i < v->count; i++) {
-    v->cell[i] = lval_eval(e, v->cell[i]);
-  }
+lval* builtin_str_sub(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 3, "str-sub");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_NUM, "str-sub");
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_NUM, "str-sub");
+  LASSERT_TYPE(a, a->cell[2]->type, LVAL_STR, "str-sub");
 
-  for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) {
-      return lval_take(v, i);
-    }
-  }
+  long start = a->cell[0]->num;
+  long end = a->cell[1]->num;
+  lval* s = a->cell[2];
 
-  if (v->count == 0) { return v; }
-  if (v->count == 1) { return lval_take(v, 0); }
+  LASSERT(a, start >= 0 && start <= end,
+    "Function 'str-sub' passed invalid range %li to %li.", start, end);
 
-  lval* f = lval_pop(v, 0);
+  // like slice, running off the end just stops there
+  if (end > s->len) { end = s->len; }
+  if (start > end) { start = end; }
 
-  if (f->type != LVAL_FUN) {
-    lval* err = lval_err("S-Expression starts with incorrect type. "
-      "got %s, expected %s.",
-      ltype_name(f->type), ltype_name(LVAL_FUN));
+  lval* x = lval_str_view(s, start, end - start);
+  lval_del(a);
 
-    lval_del(f);
-    lval_del(v);
+  return x;
+}
 
-    return err;
-  }
+lval* builtin_str_len(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "str-len");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_STR, "str-len");
 
-  lval* result = lval_call(e, f, v);
-  lval_del(f);
+  lval* n = lval_num(a->cell[0]->len);
+  lval_del(a);
 
-  return result;
+  return n;
 }
 
-lenv* lenv_new(void) {
-  lenv* e = malloc(sizeof(lenv));
-  e->par = NULL;
-  e->count = 0;
-  e->syms = NULL;
-  e->vals = NULL;
+// first index of needle in s at or after from, -1 when it isn't there
+int lval_str_find(lval* s, lval* needle, int from) {
+  char* h = lval_str_ptr(s);
+  char* n = lval_str_ptr(needle);
 
-  return e;
-};
+  if (needle->len == 0) { return from <= s->len ? from : -1; }
 
-void lenv_del(lenv* e) {
-  for (int i = 0; i < e->count; i++) {
-    free(e->syms[i]);
-    lval_del(e->vals[i]);
-  }
-  free(e->syms);
-  free(e->vals);
-  free(e);
-}
+  for (int i = from; i + needle->len <= s->len; i++) {
+    char* c = memchr(h + i, n[0], s->len - needle->len - i + 1);
+    if (!c) { return -1; }
 
-lval* lenv_get(lenv* e, lval* k) {
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      return lval_copy(e->vals[i]);
-    }
+    i = c - h;
+    if (memcmp(c, n, needle->len) == 0) { return i; }
   }
 
-  if (e->par) {
-    return lenv_get(e->par, k);
-  } else {
-    return lval_err("Unbound Symbol '%s'", k->sym);
-  }
+  return -1;
 }
 
-void lenv_put(lenv* e, lval* k, lval* v) {
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
+lval* builtin_str_find(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "str-find");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_STR, "str-find");
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_STR, "str-find");
 
-      return;
-    }
+  lval* i = lval_num(lval_str_find(a->cell[1], a->cell[0], 0));
+  lval_del(a);
+
+  return i;
+}
+
+lval* builtin_str_split(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 2, "str-split");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_STR, "str-split");
+  LASSERT_TYPE(a, a->cell[1]->type, LVAL_STR, "str-split");
+  LASSERT(a, a->cell[0]->len > 0, "Function 'str-split' passed empty separator.");
+
+  lval* sep = a->cell[0];
+  lval* s = a->cell[1];
+  lval* x = lval_qexpr();
+
+  // the pieces are views into s, nothing is copied unless they're short
+  int start = 0;
+  int i;
+  while ((i = lval_str_find(s, sep, start)) != -1) {
+    x = lval_add(x, lval_str_view(s, start, i - start));
+    start = i + sep->len;
   }
+  x = lval_add(x, lval_str_view(s, start, s->len - start));
 
-  e->count++;
-  e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-  e->syms = realloc(e->syms, sizeof(char*) * e->count);
+  lval_del(a);
 
-  e->vals[e->count - 1] = lval_copy(v);
-  e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-  strcpy(e->syms[e->count - 1], k->sym);
+  return x;
 }
 
-void lenv_def(lenv* e, lval* k, lval* v) {
-  while (e->par) {
-    e = e->par;
+// appends n bytes to b. when b is the newest version of its buffer and
+// there is room the bytes go straight in, older copies only ever look at
+// the bytes before their own len so they can't see it. otherwise b moves
+// to a buffer of twice the size, keeping appends amortised O(1)
+void lval_builder_append(lval* b, char* s, int n) {
+  lbuf* buf = b->buf;
+
+  // claiming the space is a compare and swap on the buffer's len, so two
+  // copies appending at the same time from different threads can't both win
+  int len = b->len;
+  if (len + n <= buf->cap && __atomic_compare_exchange_n(&buf->len, &len,
+      len + n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+    memcpy(buf->data + b->len, s, n);
+    b->len += n;
+    return;
   }
 
-  lenv_put(e, k, v);
-}
+  int cap = buf->cap * 2;
+  if (cap < b->len + n) { cap = b->len + n; }
 
-lenv* lenv_copy(lenv* e) {
-  lenv* n = malloc(sizeof(lenv));
+  b->buf = lbuf_new(cap);
+  memcpy(b->buf->data, buf->data, b->len);
+  // s may point into the old buffer so copy it before letting go
+  memcpy(b->buf->data + b->len, s, n);
+  b->len += n;
+  b->buf->len = b->len;
 
-  n->par = e->par;
-  n->count = e->count;
-  n->syms = malloc(sizeof(char*) * n->count);
-  n->vals = malloc(sizeof(lval*) * n->count);
+  if (LREF_DEC(buf->refs) == 0) { free(buf); }
+}
 
-  for (int i = 0; i < e->count; i++) {
-    n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-    strcpy(n->syms[i], e->syms[i]);
-    n->vals[i] = lval_copy(e->vals[i]);
+lval* builtin_builder(lenv* e, lval* a) {
+  // (builder "") for an empty one, (builder) is just the builtin
+  for (int i = 0; i < a->count; i++) {
+    LASSERT_TYPE(a, a->cell[i]->type, LVAL_STR, "builder");
   }
 
-  return n;
-}
+  lval* b = lval_builder();
 
-void lenv_add_builtin(lenv* e, char* name, lbuiltin func) {
-  lval* k = lval_sym(name);
-  lval* v = lval_fun(func);
+  for (int i = 0; i < a->count; i++) {
+    lval_builder_append(b, lval_str_ptr(a->cell[i]), a->cell[i]->len);
+  }
 
-  lenv_put(e, k, v);
-  lval_del(k);
-  lval_del(v);
-}
+  lval_del(a);
 
-lval* builtin_var(lenv* e, lval* a, char* func) {
-  LASSERT_TYPE(a, a->cell[0]->type, LVAL_QEXPR, func);
+  return b;
+}
 
-  lval* syms = a->cell[0];
+lval* builtin_builder_append(lenv* e, lval* a) {
+  LASSERT(a, a->count > 0, "Function 'builder-append' passed no arguments.");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_BUILDER, "builder-append");
 
-  for (int i = 0; i < syms->count; i++) {
-    LASSERT(a, syms->cell[i]->type == LVAL_SYM,
-      "Funcion %s cannot define non-symbol",
-      ltype_name(syms->cell[i]->type));
+  for (int i = 1; i < a->count; i++) {
+    LASSERT_TYPE(a, a->cell[i]->type, LVAL_STR, "builder-append");
   }
 
-  // value indicies are all symbol indicies + 1 b/c first index of values is 
-  // symbols qexpr
-  LASSERT(a, syms->count == a->count - 1,
-    "Function def cannot define inequal number of values to symbols. "
-    "Got %i symbols and %i values.",
-    syms->count, a->count - 1);
+  lval* b = a->cell[0];
 
-  for (int i = 0; i < syms->count; i++) {
+  for (int i = 1; i < a->count; i++) {
+    lval_builder_append(b, lval_str_ptr(a->cell[i]), a->cell[i]->len);
+  }
 
-    if (strcmp(func, "def") == 0) {
-      lenv_def(e, syms->cell[i], a->cell[i + 1]);
-    }
+  return lval_take(a, 0);
+}
 
-    if (strcmp(func, "=") == 0) {
-      lenv_put(e, syms->cell[i], a->cell[i + 1]);
-    }
-  }
+lval* builtin_builder_str(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "builder-str");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_BUILDER, "builder-str");
 
+  // the text so far never changes, so the string just shares it
+  lval* s = lval_str_view(a->cell[0], 0, a->cell[0]->len);
   lval_del(a);
 
-  return lval_sexpr();
+  return s;
 }
 
-lval* builtin_def(lenv* e, lval* a) {
-  return builtin_var(e, a, "def");
-}
+lval* builtin_builder_len(lenv* e, lval* a) {
+  LASSERT_ARGS(a, 1, "builder-len");
+  LASSERT_TYPE(a, a->cell[0]->type, LVAL_BUILDER, "builder-len");
 
-lval* builtin_put(lenv* e, lval* a) {
-  return builtin_var(e, a, "=");
+  lval* n = lval_num(a->cell[0]->len);
+  lval_del(a);
+
+  return n;
 }
 
 // ADD COMMENTS AND SHIT. THIS IS CONFUSING
@@ -812,6 +4216,60 @@ void lenv_add_builtins(lenv* e) {
   lenv_add_builtin(e, "cons", builtin_cons);
   lenv_add_builtin(e, "init", builtin_init);
   lenv_add_builtin(e, "len", builtin_len);
+  lenv_add_builtin(e, "nth", builtin_nth);
+  lenv_add_builtin(e, "last", builtin_last);
+  lenv_add_builtin(e, "take", builtin_take);
+  lenv_add_builtin(e, "drop", builtin_drop);
+  lenv_add_builtin(e, "slice", builtin_slice);
+  lenv_add_builtin(e, "deep-count", builtin_deep_count);
+
+  // these call the function from C instead of recursing through lambdas
+  lenv_add_builtin(e, "map", builtin_map);
+  lenv_add_builtin(e, "filter", builtin_filter);
+  lenv_add_builtin(e, "foldl", builtin_foldl);
+  lenv_add_builtin(e, "foldr", builtin_foldr);
+  lenv_add_builtin(e, "for-each", builtin_for_each);
+  lenv_add_builtin(e, "range", builtin_range);
+  lenv_add_builtin(e, "iterate", builtin_iterate);
+  lenv_add_builtin(e, "collect", builtin_collect);
+  lenv_add_builtin(e, "pmap", builtin_pmap);
+  lenv_add_builtin(e, "preduce", builtin_preduce);
+  lenv_add_builtin(e, "par", builtin_par);
+  lenv_add_builtin(e, "future", builtin_future);
+  lenv_add_builtin(e, "deref", builtin_deref);
+  lenv_add_builtin(e, "await", builtin_await);
+  lenv_add_builtin(e, "spawn", builtin_spawn);
+  lenv_add_builtin(e, "chan", builtin_chan);
+  lenv_add_builtin(e, "send", builtin_send);
+  lenv_add_builtin(e, "recv", builtin_recv);
+  lenv_add_builtin(e, "yield", builtin_yield);
+  lenv_add_builtin(e, "sort", builtin_sort);
+  lenv_add_builtin(e, "sort-by", builtin_sort_by);
+  lenv_add_builtin(e, "stable-sort-by", builtin_stable_sort_by);
+
+  lenv_add_builtin(e, "dict", builtin_dict);
+  lenv_add_builtin(e, "dict-get", builtin_dict_get);
+  lenv_add_builtin(e, "dict-put", builtin_dict_put);
+  lenv_add_builtin(e, "dict-del", builtin_dict_del);
+  lenv_add_builtin(e, "dict-keys", builtin_dict_keys);
+  lenv_add_builtin(e, "dict-size", builtin_dict_size);
+
+  lenv_add_builtin(e, "hash-map", builtin_hash_map);
+  lenv_add_builtin(e, "assoc", builtin_assoc);
+  lenv_add_builtin(e, "dissoc", builtin_dissoc);
+  lenv_add_builtin(e, "get", builtin_get);
+  lenv_add_builtin(e, "hash-map-size", builtin_hash_map_size);
+
+  lenv_add_builtin(e, "str-concat", builtin_str_concat);
+  lenv_add_builtin(e, "str-sub", builtin_str_sub);
+  lenv_add_builtin(e, "str-len", builtin_str_len);
+  lenv_add_builtin(e, "str-find", builtin_str_find);
+  lenv_add_builtin(e, "str-split", builtin_str_split);
+
+  lenv_add_builtin(e, "builder", builtin_builder);
+  lenv_add_builtin(e, "builder-append", builtin_builder_append);
+  lenv_add_builtin(e, "builder-str", builtin_builder_str);
+  lenv_add_builtin(e, "builder-len", builtin_builder_len);
 
   lenv_add_builtin(e, "def", builtin_def);
   lenv_add_builtin(e, "=", builtin_put);
@@ -828,35 +4286,171 @@ lval* lval_eval(lenv* e, lval* v) {
 
     return x;
   }
-  if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+  if (v->type == LVAL_SEXPR) {
+    if (lgreen_limit && (char*)&v < lgreen_limit) {
+      // v can be just as deep as what got us here, too deep to free now
+      lsched* s = linterp_current->sched;
+      if (!s->dead) { s->dead = lval_qexpr(); }
+      lval_add(s->dead, v);
+
+      return lval_err("Evaluation too deep for a green thread's stack.");
+    }
+
+    return lval_eval_sexpr(e, v);
+  }
 
   return v;
 }
 
-int main(int argc, char** argv) {
-  mpc_parser_t* Number = mpc_new("number");
-  mpc_parser_t* Symbol = mpc_new("symbol");
-  mpc_parser_t* Sexpr = mpc_new("sexpr");
-  mpc_parser_t* Qexpr = mpc_new("qexpr");
-  mpc_parser_t* Expr = mpc_new("expr");
-  mpc_parser_t* Lispy = mpc_new("lispy");
-
-  mpca_lang(MPCA_LANG_DEFAULT,
+linterp* linterp_new(void) {
+  linterp* in = malloc(sizeof(linterp));
+  in->pool = NULL;
+  in->sched = NULL;
+  in->futures = 0;
+  pthread_rwlock_init(&in->lock, NULL);
+  in->validate = 0;
+  in->input = mpc_input_new();
+
+  in->Number = mpc_new("number");
+  in->Symbol = mpc_new("symbol");
+  in->String = mpc_new("string");
+  in->Sexpr = mpc_new("sexpr");
+  in->Qexpr = mpc_new("qexpr");
+  in->Expr = mpc_new("expr");
+  in->Lispy = mpc_new("lispy");
+
+  // the regexes are written so a DFA matches them just like mpc_re would
+  mpca_lang(MPCA_LANG_DFA_REGEX,
     "                                                                         \
       number    : /-?[0-9]+/ ;                                                \
       symbol    : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&\\^%]+/ ;                      \
+      string    : /\"(\\\\.|[^\"\\\\])*\"/ ;                                  \
       sexpr     : '(' <expr>* ')' ;                                           \
       qexpr     : '{' <expr>* '}' ;                                           \
-      expr      : <number> | <symbol> | <sexpr> | <qexpr> ;                   \
+      expr      : <number> | <symbol> | <string> | <sexpr> | <qexpr> ;        \
       lispy     : /^/ <expr>* /$/ ;                                           \
     ",
-    Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+    in->Number, in->Symbol, in->String, in->Sexpr, in->Qexpr, in->Expr,
+    in->Lispy);
+
+  in->env = lenv_new();
+  lenv_add_builtins(in->env);
+
+  return in;
+}
+
+// parses and evaluates one line of input. parse errors come back as an
+// error value like any other
+lval* linterp_eval(linterp* in, char* filename, char* input) {
+  linterp* outer = linterp_current;
+  linterp_current = in;
+
+  lval* v;
+  mpc_result_t r;
+
+  if (!in->validate) {
+    v = lval_read_input(filename, input);
+  } else if (mpc_parse_borrowed(in->input, filename, input, strlen(input),
+      in->Lispy, &r)) {
+    v = lval_read(r.output);
+    mpc_ast_delete(r.output);
+  } else {
+    char* msg = mpc_err_string(r.error);
+    msg[strcspn(msg, "\n")] = '\0';
+    v = lval_err("%s", msg);
+    free(msg);
+    mpc_err_delete(r.error);
+  }
 
+  // a read error is already the answer, evaluating it would just return it
+  lval* result = lval_eval(in->env, v);
+  if (in->sched) { lsched_drain(in->sched); }
+
+  linterp_current = outer;
+
+  return result;
+}
+
+// the errors of green threads that failed since the last call, as a
+// Q-Expression the caller owns, or NULL if none did
+lval* linterp_errors(linterp* in) {
+  if (!in->sched || !in->sched->errors) { return NULL; }
+
+  lval* v = in->sched->errors;
+  in->sched->errors = NULL;
+
+  return v;
+}
+
+void linterp_del(linterp* in) {
+  // queued futures still need to find their interpreter
+  linterp* outer = linterp_current;
+  linterp_current = in;
+  lsched_del(in->sched);
+  lpool_del(in->pool);
+  linterp_current = outer;
+
+  lenv_del(in->env);
+  pthread_rwlock_destroy(&in->lock);
+  mpc_input_delete(in->input);
+  mpc_cleanup(7, in->Number, in->Symbol, in->String, in->Sexpr, in->Qexpr,
+    in->Expr, in->Lispy);
+  free(in);
+
+  lval_free_drain();
+}
+
+// the grammar's token regexes go to mpc_re_dfa, which should accept just
+// what mpc_re would. --validate checks that on them, and on the escapes
+// where the two are easiest to get out of step
+char* lregex_checks[] = {
+  "-?[0-9]+", "[a-zA-Z0-9_+\\-*/\\\\=<>!&\\^%]+", "\"(\\\\.|[^\"\\\\])*\"",
+  "a\\", "\\D+", "\\S+", "\\W+", "x{0}y", "(ab){2}", "[^a-c]+", NULL
+};
+
+char* lregex_inputs[] = {
+  "", "0", "-", "-12", "12a", "abc", "+-*", "a\\b", "\"\"", "\"a\\\"b\"",
+  "\"a\\\"", "\"a", "\xc3\xa9", " \t x", "xy", "y", "ababab", NULL
+};
+
+// how many inputs the two disagreed on, each reported on stderr
+int lregex_check(void) {
+  int bad = 0;
+
+  for (int i = 0; lregex_checks[i]; i++) {
+    mpc_parser_t* re = mpc_re(lregex_checks[i]);
+    mpc_parser_t* dfa = mpc_re_dfa(lregex_checks[i]);
+
+    for (int j = 0; lregex_inputs[j]; j++) {
+      mpc_result_t a, b;
+      int x = mpc_parse("<check>", lregex_inputs[j], re, &a);
+      int y = mpc_parse("<check>", lregex_inputs[j], dfa, &b);
+
+      if (x != y || (x && strcmp(a.output, b.output) != 0)) {
+        fprintf(stderr, "regex /%s/ and its DFA disagree on \"%s\"\n",
+          lregex_checks[i], lregex_inputs[j]);
+        bad++;
+      }
+
+      if (x) { free(a.output); } else { mpc_err_delete(a.error); }
+      if (y) { free(b.output); } else { mpc_err_delete(b.error); }
+    }
+
+    mpc_delete(re);
+    mpc_delete(dfa);
+  }
+
+  return bad;
+}
+
+int main(int argc, char** argv) {
   puts("Lispy Version 0.0.1");
   puts("Press Ctrl+c to Exit\n");
 
-  lenv* e = lenv_new();
-  lenv_add_builtins(e);
+  linterp* in = linterp_new();
+  in->validate = argc > 1 && strcmp(argv[1], "--validate") == 0;
+
+  if (in->validate) { lregex_check(); }
 
   while(1) {
     char* input = readline("lispy> ");
@@ -865,26 +4459,23 @@ int main(int argc, char** argv) {
 //    printf("line\n");
 //    printf("input is %s \n", input);
 
-    mpc_result_t r;
-    if (mpc_parse("<stdin>", input, Lispy, &r)) {
-      // success?
-      lval* result = lval_eval(e, lval_read(r.output));
-      lval_println(e, result);
-      lval_del(result);
+    lval* result = linterp_eval(in, "<stdin>", input);
 
-//      mpc_ast_print(r.output);
-      mpc_ast_delete(r.output);
-    } else {
-      // fail
-      mpc_err_print(r.error);
-      mpc_err_delete(r.error);
+    lval* errors = linterp_errors(in);
+    if (errors) {
+      for (int i = 0; i < errors->count; i++) {
+        lval_println(in->env, errors->cell[i]);
+      }
+      lval_del(errors);
     }
 
+    lval_println(in->env, result);
+    lval_del(result);
+
     free(input);
   }
 
-  lenv_del(e);
-  mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+  linterp_del(in);
 
   return 0;
 }